@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# tm32bench.sh runs the disassembler over synthetic instruction streams written by tm32gen, and
+# reports its throughput in each output format, as measured by tm32dis --profile.
+#
+# usage: tm32bench.sh <data directory> <size in MB> ...
+#
+# The streams are kept in the data directory and reused by later runs, as the large ones take a
+# while to write. Each size is run as a plain stream and as a memory image (-m). The disassembly
+# itself goes to /dev/null. Set TM32GENFLAGS to change the mix of the streams, e.g.
+# TM32GENFLAGS="--sizes 0,1,0,0 --tree 32", and remove the data directory after changing it.
+
+set -e
+
+dir=${1:-bench}
+shift
+[ $# -gt 0 ] || set -- 1 64 1024
+
+mkdir -p "$dir"
+
+# value <key> <file> prints the value of profile.<key> in the --profile output in file
+value() {
+    sed -n "s/^profile\.$1=//p" "$2"
+}
+
+printf "%-8s %-7s %-6s %10s %12s %12s %12s\n" size input format seconds "MB/s" "Minsn/s" "Mops/s"
+for size in "$@"; do
+    for input in plain memimg; do
+        flags=
+        [ $input = memimg ] && flags=-m
+        data="$dir/gen-${size}m-$input.bin"
+        if [ ! -f "$data" ]; then
+            ./tm32gen $flags $TM32GENFLAGS -c "${size}M" -o "$data.tmp"
+            mv "$data.tmp" "$data"
+        fi
+        for format in 0 1 json bin; do
+            ./tm32dis --profile $flags -f $format -i "$data" > /dev/null 2> "$dir/profile.txt"
+            awk -v size="${size}M" -v input=$input -v format=$format \
+                -v ns="$(value total.ns "$dir/profile.txt")" \
+                -v bytes="$(value bytes_per_s "$dir/profile.txt")" \
+                -v insns="$(value instructions_per_s "$dir/profile.txt")" \
+                -v ops="$(value operations_per_s "$dir/profile.txt")" \
+                'BEGIN { printf "%-8s %-7s %-6s %10.3f %12.1f %12.2f %12.2f\n", size, input, format, ns / 1e9, bytes / 1048576, insns / 1e6, ops / 1e6 }'
+        done
+    done
+done
+rm -f "$dir/profile.txt"
@@ -0,0 +1,180 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com>
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined(__MINGW32__)
+#define _DEFAULT_SOURCE                             // for mkstemp() and fchmod() under -std=c99
+#define _BSD_SOURCE
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(__MINGW32__)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "tm32dis.h"
+
+
+// The memory image cache keeps transposed memory images in a directory (--cache-dir), so that
+// later runs over the same file map the result instead of reading and transposing it again. The
+// whole image is transposed once, in blocks from the phase of the first skip that needs it, and any
+// window of that phase is then served from the one file. A cache file is named by the device and
+// inode of the image and the phase, and its header records the length and modification time of the
+// image. A file rewritten since then is transposed again, into the same name, so each image keeps at
+// most one cache file for each phase. Each file is written under a temporary name and renamed into
+// place whole, so processes that fill the cache at once never see part of a file, and the last
+// rename wins.
+//
+// The file holds a header and then the transposed bytes. The header is little endian:
+//
+//   magic "TM32MEM" and a zero byte, version, block size, phase (the byte of the image where the
+//   first block starts), image length, modification time in nanoseconds, device, inode, length of
+//   the transposed bytes
+
+#define MEMCACHEMAGIC       "TM32MEM"
+#define MEMCACHEVERSION     3
+#define MEMCACHEHEADERBYTES 72
+
+// putmemcacheheader() writes to header the header of the cache file for the bytecount transposed bytes
+// of the image img, in blocks from byte base
+static void putmemcacheheader(uint8_t *header, const struct OBJIMAGE *img, uint64_t base, uint64_t bytecount) {
+    memcpy(header, MEMCACHEMAGIC, 8);
+    putle(header + 8, MEMCACHEVERSION, 4);
+    putle(header + 12, MEMIMGBLOCK, 4);
+    putle(header + 16, base, 8);
+    putle(header + 24, img->filelength, 8);
+    putle(header + 32, img->mtime, 8);
+    putle(header + 40, img->device, 8);
+    putle(header + 48, img->inode, 8);
+    putle(header + 56, bytecount, 8);
+    memset(header + 64, 0, MEMCACHEHEADERBYTES - 64);
+}
+
+// readmemcache() maps the cache file path into cached, if it holds the bytecount transposed bytes of
+// the image img as it is now, in blocks from byte base. returns a pointer to the bytes, or NULL if there
+// is no such cache file
+static uint8_t *readmemcache(const char *path, const struct OBJIMAGE *img, uint64_t base, uint64_t bytecount, struct OBJIMAGE *cached) {
+    uint8_t header[MEMCACHEHEADERBYTES], *p;
+
+    if(openobjfile(path, cached) < 0)
+        return NULL;
+    putmemcacheheader(header, img, base, bytecount);
+    if(cached->filelength != MEMCACHEHEADERBYTES + bytecount || !(p = mapobjwindow(cached, 0, cached->filelength, FALSE)) ||
+       memcmp(p, header, MEMCACHEHEADERBYTES)) {
+        closeobjfile(cached);
+        return NULL;
+    }
+    return p + MEMCACHEHEADERBYTES;
+}
+
+// writememcache() writes the bytecount transposed bytes at objbuf of the image img, in blocks from byte
+// base, to the cache file path. returns 0 on success, -1 on error (which is reported)
+static int32_t writememcache(const char *path, const struct OBJIMAGE *img, uint64_t base, const uint8_t *objbuf, uint64_t bytecount) {
+    uint8_t header[MEMCACHEHEADERBYTES];
+    char *temp;
+    char *slash;
+    int32_t fd, ret = -1, renamed = FALSE;
+    FILE *fout = NULL;
+
+    if(!(temp = (char *) malloc(strlen(path) + 16)))
+        return -1;
+    strcpy(temp, path);                                             // a temporary name in the same directory
+    slash = strrchr(temp, '/');
+    strcpy(slash ? slash + 1 : temp, ".tm32mem-XXXXXX");
+#if defined(__MINGW32__)
+    fd = _mktemp(temp) ? _open(temp, _O_CREAT | _O_EXCL | _O_WRONLY | _O_BINARY, _S_IREAD | _S_IWRITE) : -1;
+#else
+    if((fd = mkstemp(temp)) >= 0)
+        fchmod(fd, 0644);                                           // readable by the other users of the cache
+#endif
+    if(fd < 0 || !(fout = fdopen(fd, "wb"))) {
+        fprintf(stderr, "Could not create a memory image cache file in the directory of '%s'\n", path);
+        if(fd >= 0) {
+            close(fd);
+            remove(temp);
+        }
+        free(temp);
+        return -1;
+    }
+
+    putmemcacheheader(header, img, base, bytecount);
+    if(fwrite(header, 1, MEMCACHEHEADERBYTES, fout) == MEMCACHEHEADERBYTES && fwrite(objbuf, 1, bytecount, fout) == bytecount &&
+       fclose(fout) == 0) {
+        fout = NULL;
+        if(rename(temp, path) == 0) {
+            ret = 0;
+            renamed = TRUE;
+        }
+#if defined(__MINGW32__)
+        else if(access(path, 0) == 0)                               // Windows will not rename over a file, which another
+            ret = 0;                                                // process has just written with the same bytes
+#endif
+    }
+    if(ret < 0)
+        fprintf(stderr, "Could not write memory image cache file '%s'\n", path);
+    if(fout)
+        fclose(fout);
+    if(!renamed)                                                    // once renamed, the name may be another process's
+        remove(temp);
+    free(temp);
+    return ret;
+}
+
+// cachedmemimg() returns the transposed bytes of the memory image img from byte skip, which run to the
+// end of the image. If the cache directory cachedir holds the image, transposed in blocks of the phase
+// of skip, its cache file is mapped into cached and the image itself is not read. If not, the image is
+// mapped writable, transposed whole in place as extractmemimginplace() does, and written to the cache.
+// An image with no inode (not a regular file, or on Windows) is transposed without the cache, and a
+// cache that cannot be written is reported, but the transposed bytes are still returned.
+// returns NULL if the image cannot be read
+
+uint8_t *cachedmemimg(struct TM32CTX *ctx, const char *cachedir, struct OBJIMAGE *img, uint64_t skip, struct OBJIMAGE *cached) {
+    uint64_t base = skip % MEMIMGBLOCK, bytecount = MEMIMGBYTES(img->filelength - base);
+    uint8_t *p, *objbuf;
+    char *path = NULL;
+
+    if(img->inode) {
+        if(!(path = (char *) malloc(strlen(cachedir) + 80)))
+            fprintf(stderr, "Could not malloc space for a cache file name\n");
+        else {
+            sprintf(path, "%s/tm32mem-%" PRIx64 "-%" PRIx64 "-%" PRIx64 ".bin", cachedir, img->device, img->inode, base);
+            if((p = readmemcache(path, img, base, bytecount, cached))) {
+                fprintf(stdout, "Reading transposed memory image from cache file '%s'\n", path);
+                free(path);
+                return p + skip - base;
+            }
+        }
+    }
+    if(!(objbuf = mapobjwindow(img, base, img->filelength - base, TRUE))) {
+        free(path);
+        return NULL;
+    }
+    fprintf(stdout, "Transposing memory image from bit-striped to sequential bytes\n");
+    extractmemimginplace(ctx, objbuf, bytecount);
+    if(path)
+        writememcache(path, img, base, objbuf, bytecount);
+    free(path);
+    return objbuf + skip - base;
+}
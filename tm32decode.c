@@ -24,126 +24,464 @@
 #endif
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 #include "tm32dis.h"
 #include "tm32disinstrs.h"
 
 
+static const uint8_t *illegalprefix[] = { "", "26", "34-0", "34-1", "42", "42", "42" };
+
+// Decoding and rendering are both driven by tables. decoderules[][] gives, for each size class of
+// operation and each property of opcode, the operand form and the bit field that holds each operand.
+// formtemplates[] then gives the operands that each form is rendered with. An opcode added to
+// oplist[] with an existing property needs no new code at all.
+
+// the bit fields of an operation that a DECODERULE selects its operands from. FIELD_R1 is the
+// constant 1, the guard register of the unguarded operations, which always reads as true
+
+enum OPFIELD {
+    FIELD_NONE,
+    FIELD_R1,
+    FIELD_6_0,
+    FIELD_13_7,
+    FIELD_20_14,
+    FIELD_32_26,
+    FIELD_41_35
+};
+
+static const uint8_t fieldshift[] = { 0, 0, 0,    7,    14,   26,   35 };
+static const uint8_t fieldmask[]  = { 0, 0, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f };
+static const uint8_t fieldconst[] = { 0, 1, 0,    0,    0,    0,    0 };
+
+#define GETFIELD(opint64, field)    ((uint32_t) ((opint64) >> fieldshift[field] & fieldmask[field]) | fieldconst[field])
+
+// how the parameter of an operation is found
+
+enum PARAMKIND {
+    PARAM_NONE,
+    PARAM_7,                                            //   7 bits, signed if the operation is, times its paramfactor
+    PARAM_7SIGNED,                                      //   7 bits, always signed, times its paramfactor
+    PARAM_32                                            //   the 32-bit immediate, see PARAM32BITS()
+};
+
+// struct DECODERULE is one entry of decoderules[][]. An entry whose guard is FIELD_NONE is
+// an opcode that is illegal in its size class
+
+struct DECODERULE {
+    uint8_t form;                                       //   enum OPFORM
+    uint8_t guard;                                      //   enum OPFIELD of each operand
+    uint8_t param;                                      //   enum PARAMKIND
+    uint8_t paramfield;
+    uint8_t src1;
+    uint8_t src2;
+    uint8_t dst;
+};
+
+#define RULE(form, guard, src1, src2, dst) \
+    { FORM_##form, FIELD_##guard, PARAM_NONE, FIELD_NONE, FIELD_##src1, FIELD_##src2, FIELD_##dst }
+#define PRULE(form, guard, param, paramfield, src1, src2, dst) \
+    { FORM_##form, FIELD_##guard, PARAM_##param, FIELD_##paramfield, FIELD_##src1, FIELD_##src2, FIELD_##dst }
+
+static const struct DECODERULE decoderules[OPCLASS_42LONG + 1][NOPROP + 1] = {
+    [OPCLASS_26] = {
+        [BINARY_UNGUARDED_SHORT]                    = RULE(BINARY, R1, 6_0, 13_7, 20_14),
+        [BINARY_SHORT]                              = RULE(BINARY, R1, 6_0, 13_7, 20_14),
+        [UNARY_PARAM7_UNGUARDED_SHORT]              = PRULE(PARAM_UNARY, R1, 7, 13_7, 6_0, NONE, 20_14),
+        [UNARY_PARAM7_SHORT]                        = PRULE(PARAM_UNARY, R1, 7, 13_7, 6_0, NONE, 20_14),
+        [BINARY_UNGUARDED_PARAM7_RESULTLESS_SHORT]  = PRULE(PARAM_BINARY_RESULTLESS, R1, 7SIGNED, 20_14, 6_0, 13_7, NONE),
+        [BINARY_PARAM7_RESULTLESS_SHORT]            = PRULE(PARAM_BINARY_RESULTLESS, R1, 7SIGNED, 20_14, 6_0, 13_7, NONE),
+        [UNARY_SHORT]                               = RULE(UNARY, 20_14, 6_0, NONE, 13_7)
+    },
+    [OPCLASS_34SHORT] = {
+        [BINARY_UNGUARDED_SHORT]                    = RULE(BINARY, 20_14, 6_0, 13_7, 32_26),
+        [BINARY_SHORT]                              = RULE(BINARY, 20_14, 6_0, 13_7, 32_26),
+        [UNARY_SHORT]                               = RULE(UNARY, 20_14, 6_0, NONE, 32_26),
+        [UNARY_PARAM7_UNGUARDED_SHORT]              = PRULE(PARAM_UNARY, 20_14, 7, 13_7, 6_0, NONE, 32_26),
+        [UNARY_PARAM7_SHORT]                        = PRULE(PARAM_UNARY, 20_14, 7, 13_7, 6_0, NONE, 32_26),
+        [BINARY_UNGUARDED_PARAM7_RESULTLESS_SHORT]  = PRULE(PARAM_BINARY_RESULTLESS, 20_14, 7, 32_26, 6_0, 13_7, NONE),
+        [BINARY_PARAM7_RESULTLESS_SHORT]            = PRULE(PARAM_BINARY_RESULTLESS, 20_14, 7, 32_26, 6_0, 13_7, NONE)
+    },
+    [OPCLASS_34LONG] = {
+        [BINARY_UNGUARDED]                          = RULE(BINARY, R1, 6_0, 13_7, 20_14),
+        [BINARY]                                    = RULE(BINARY, R1, 6_0, 13_7, 20_14),
+        [BINARY_RESULTLESS]                         = RULE(BINARY_RESULTLESS, 20_14, 6_0, 13_7, NONE),
+        [UNARY_PARAM7]                              = PRULE(PARAM_UNARY, 20_14, 7, 13_7, 6_0, NONE, 20_14),
+        [UNARY_PARAM7_UNGUARDED]                    = PRULE(PARAM_UNARY, R1, 7, 13_7, 6_0, NONE, 20_14),
+        [UNARY]                                     = RULE(UNARY, 20_14, 6_0, NONE, 13_7),
+        [UNARY_PARAM7_RESULTLESS]                   = PRULE(PARAM_UNARY_RESULTLESS, 20_14, 7, 13_7, 6_0, NONE, NONE),
+        [ZEROARY_RESULTLESS]                        = RULE(ZEROARY_RESULTLESS, 20_14, NONE, NONE, NONE)
+    },
+    [OPCLASS_42IMM] = {
+        [ZEROARY_PARAM32_UNGUARDED]                 = PRULE(PARAM32, R1, 32, NONE, NONE, NONE, 20_14)
+    },
+    [OPCLASS_42JUMP] = {
+        [ZEROARY_PARAM32_RESULTLESS]                = PRULE(PARAM32_RESULTLESS, 20_14, 32, NONE, NONE, NONE, NONE)
+    },
+    [OPCLASS_42LONG] = {
+        [BINARY_UNGUARDED_SHORT]                    = RULE(BINARY, R1, 6_0, 13_7, 41_35),
+        [BINARY_UNGUARDED]                          = RULE(BINARY, R1, 6_0, 13_7, 41_35),
+        [UNARY_PARAM7_UNGUARDED_SHORT]              = PRULE(PARAM_UNARY, R1, 7, 13_7, 6_0, NONE, 41_35),
+        [UNARY_PARAM7_UNGUARDED]                    = PRULE(PARAM_UNARY, R1, 7, 13_7, 6_0, NONE, 41_35),
+        [BINARY_UNGUARDED_PARAM7_RESULTLESS_SHORT]  = PRULE(PARAM_BINARY_RESULTLESS, R1, 7, 41_35, 6_0, 13_7, NONE),
+        [UNARY_SHORT]                               = RULE(UNARY, 20_14, 6_0, NONE, 41_35),
+        [UNARY]                                     = RULE(UNARY, 20_14, 6_0, NONE, 41_35),
+        [BINARY_SHORT]                              = RULE(BINARY, 20_14, 6_0, 13_7, 41_35),
+        [BINARY]                                    = RULE(BINARY, 20_14, 6_0, 13_7, 41_35),
+        [UNARY_PARAM7_SHORT]                        = PRULE(PARAM_UNARY, 20_14, 7, 13_7, 6_0, NONE, 41_35),
+        [UNARY_PARAM7]                              = PRULE(PARAM_UNARY, 20_14, 7, 13_7, 6_0, NONE, 41_35),
+        [BINARY_PARAM7_RESULTLESS_SHORT]            = PRULE(PARAM_BINARY_RESULTLESS, 20_14, 7, 41_35, 6_0, 13_7, NONE),
+        [BINARY_PARAM7_RESULTLESS]                  = PRULE(PARAM_BINARY_RESULTLESS, 20_14, 7, 41_35, 6_0, 13_7, NONE),
+        [BINARY_RESULTLESS]                         = RULE(BINARY_RESULTLESS, 20_14, 6_0, 13_7, NONE),
+        [UNARY_PARAM7_RESULTLESS]                   = PRULE(PARAM_UNARY_RESULTLESS, 20_14, 7, 13_7, 6_0, NONE, NONE),
+        [ZEROARY]                                   = RULE(ZEROARY, 20_14, NONE, NONE, 41_35),
+        [ZEROARY_RESULTLESS]                        = RULE(ZEROARY_RESULTLESS, 20_14, NONE, NONE, NONE),
+        [UNARY_RESULTLESS]                          = RULE(UNARY_RESULTLESS, 20_14, 6_0, NONE, NONE)
+    }
+};
+
+// the size class of an operation, by its compressed size / 8 and its type bits 33 and 32.
+// OPCLASS_NOP marks a size that is not valid
+static const uint8_t sizeclasses[6][4] = {
+    [3] = { OPCLASS_26, OPCLASS_26, OPCLASS_26, OPCLASS_26 },
+    [4] = { OPCLASS_34SHORT, OPCLASS_34SHORT, OPCLASS_34LONG, OPCLASS_34LONG },
+    [5] = { OPCLASS_42JUMP, OPCLASS_42LONG, OPCLASS_42IMM, OPCLASS_42IMM }
+};
+
+// where the opcode of each size class is found: opcode = base + ((opint64 >> shift) & mask).
+// The immediates have the one opcode, and the jumps take theirs from the sign flag in bit 31
+static const struct {
+    uint8_t base;
+    uint8_t shift;
+    uint8_t mask;
+    const char *tracename;                              //   opcode trace line, if any
+} opcodefields[OPCLASS_42LONG + 1] = {
+    [OPCLASS_26]      = { 0,   21, 0x1f, "26:opcode[4:0]    " },
+    [OPCLASS_34SHORT] = { 0,   21, 0x1f, "34-0:opcode[4:0]  " },
+    [OPCLASS_34LONG]  = { 0,   21, 0xff, "34-1:opcode[7:0]  " },
+    [OPCLASS_42IMM]   = { 191, 0,  0,    NULL },                    // uimm
+    [OPCLASS_42JUMP]  = { 178, 31, 1,    NULL },                    // jmpi, or ijmpi when bit 31 is set
+    [OPCLASS_42LONG]  = { 0,   21, 0xff, "42:opcode[7:0]    " }
+};
+
+// the operands that each form is rendered with, after the name and parameter. Each is one of
+// the registers of the operation, with an arrow before it if it is the result, and printed as a
+// plain number rather than as a register name if OPND_NUMBER is set
+
+#define OPND_SRC1       1                               //   " rS1"
+#define OPND_SRC2       2                               //   " rS2"
+#define OPND_DST        (3 | OPND_ARROW)                //   " -> rD"
+#define OPND_REGMASK    3
+#define OPND_ARROW      4
+#define OPND_NUMBER     8
+
+enum PARAMTEXT {
+    PARAMTEXT_NONE,
+    PARAMTEXT_DEC,                                      //   "(P)"
+    PARAMTEXT_HEX                                       //   "(0xP)"
+};
+
+static const struct {
+    uint8_t param;                                      //   enum PARAMTEXT
+    uint8_t operand[3];                                 //   OPND_ bits, 0 after the last operand
+} formtemplates[FORM_PARAM32_RESULTLESS + 1] = {
+    [FORM_BINARY]                   = { PARAMTEXT_NONE, { OPND_SRC1, OPND_SRC2, OPND_DST } },
+    [FORM_UNARY]                    = { PARAMTEXT_NONE, { OPND_SRC1, OPND_DST } },
+    [FORM_PARAM_UNARY]              = { PARAMTEXT_DEC,  { OPND_SRC1, OPND_DST } },
+    [FORM_PARAM_BINARY_RESULTLESS]  = { PARAMTEXT_DEC,  { OPND_SRC1, OPND_SRC2 } },
+    [FORM_BINARY_RESULTLESS]        = { PARAMTEXT_NONE, { OPND_SRC1, OPND_SRC2 } },
+    [FORM_PARAM_UNARY_RESULTLESS]   = { PARAMTEXT_DEC,  { OPND_SRC1 } },
+    [FORM_ZEROARY_RESULTLESS]       = { PARAMTEXT_NONE, { 0 } },
+    [FORM_ZEROARY]                  = { PARAMTEXT_NONE, { OPND_DST | OPND_NUMBER } },
+    [FORM_UNARY_RESULTLESS]         = { PARAMTEXT_NONE, { OPND_SRC1 | OPND_NUMBER } },
+    [FORM_PARAM32]                  = { PARAMTEXT_HEX,  { OPND_DST } },
+    [FORM_PARAM32_RESULTLESS]       = { PARAMTEXT_HEX,  { 0 } }
+};
+
+// renderoperation() renders a decoded operation as text in its operand form (see enum OPFORM), e.g.
+// "IF r1   iaddi(64) r33 -> r8". The string is terminated, and a pointer to its end is returned
+uint8_t *renderoperation(uint8_t *p, const struct TM32OP *dop) {
+    const struct OPERATION *op = &oplist[dop->opindex];
+    const uint32_t regs[3] = { dop->src1, dop->src2, dop->dst };
+    uint32_t i, operand, reg;
+    uint8_t *start;
+
+    switch(dop->form) {
+        case FORM_NOP:
+            p = putstr(p, "IF r1   nop");
+            *p = '\0';
+            return p;
+        case FORM_ILLEGAL:
+            p = putstr(p, illegalprefix[dop->sizeclass]);
+            p = putstr(p, ": ILLEGAL OP! = ");
+            p = putstr(p, op->opname);
+            *p = '\0';
+            return p;
+        case FORM_BADSIZE:
+            p = putudec(putstr(p, "Unknown operation size: "), dop->size);
+            *p = '\0';
+            return p;
+        default:
+            break;
+    }
+
+    p = putstr(p, "IF ");
+    start = p;
+    p = putpad(putreg(p, dop->guard), start, 4);
+    *p++ = ' ';
+    p = putstr(p, op->opname);
+
+    if(formtemplates[dop->form].param == PARAMTEXT_DEC) {
+        *p++ = '(';
+        p = putdec(p, dop->param);
+        *p++ = ')';
+    } else if(formtemplates[dop->form].param == PARAMTEXT_HEX) {
+        p = putstr(p, "(0x");
+        p = puthex(p, (uint32_t) dop->param, 1);
+        *p++ = ')';
+    }
+
+    for(i=0;i<3 && (operand = formtemplates[dop->form].operand[i]);i++) {
+        if(operand & OPND_ARROW)
+            p = putstr(p, " -> ");
+        else
+            *p++ = ' ';
+        reg = regs[(operand & OPND_REGMASK) - 1];
+        p = (operand & OPND_NUMBER) ? putudec(p, reg) : putreg(p, reg);
+    }
+    *p = '\0';
+    return p;
+}
+
+// renderoperationjson() renders a decoded operation as a JSON object, with the fields of its operand
+// form only, e.g. {"op":"iaddi","opcode":21,"guard":1,"param":64,"src1":33,"dst":8}.
+// returns a pointer to the end of the text
+uint8_t *renderoperationjson(uint8_t *p, const struct TM32OP *dop) {
+    static const uint8_t *regkeys[3] = { ",\"src1\":", ",\"src2\":", ",\"dst\":" };
+    const struct OPERATION *op = &oplist[dop->opindex];
+    const uint32_t regs[3] = { dop->src1, dop->src2, dop->dst };
+    uint32_t i, operand;
+
+    if(dop->form == FORM_BADSIZE) {
+        p = putstr(p, "{\"illegal\":true,\"size\":");
+        p = putudec(p, dop->size);
+        *p++ = '}';
+        return p;
+    }
+    p = putstr(p, "{\"op\":\"");
+    p = putstr(p, op->opname);
+    *p++ = '"';
+    if(dop->form == FORM_NOP) {
+        *p++ = '}';
+        return p;
+    }
+    p = putstr(p, ",\"opcode\":");
+    p = putudec(p, op->opcode);
+    if(dop->form == FORM_ILLEGAL)
+        return putstr(p, ",\"illegal\":true}");
+
+    p = putstr(p, ",\"guard\":");
+    p = putudec(p, dop->guard);
+    if(formtemplates[dop->form].param == PARAMTEXT_DEC) {
+        p = putstr(p, ",\"param\":");
+        p = putdec(p, dop->param);
+    } else if(formtemplates[dop->form].param == PARAMTEXT_HEX) {
+        p = putstr(p, ",\"param\":");
+        p = putudec(p, (uint32_t) dop->param);
+    }
+    for(i=0;i<3 && (operand = formtemplates[dop->form].operand[i]);i++) {
+        p = putstr(p, regkeys[(operand & OPND_REGMASK) - 1]);
+        p = putudec(p, regs[(operand & OPND_REGMASK) - 1]);
+    }
+    *p++ = '}';
+    return p;
+}
+
 // decodeoperation() takes the 64-bit unsigned integer opint64 and parses out the bit fields
-// which hold the operation code, operands, parameters, predicates, etc..
-uint64_t decodeoperation(uint32_t opsize, uint64_t opint64, uint8_t *opstring) {
+// which hold the operation code, operands, parameters, predicates, etc.. into the structure dop.
+// No text is produced; see renderoperation()
+uint64_t decodeoperation(struct TM32CTX *ctx, uint32_t opsize, uint64_t opint64, struct TM32OP *dop) {
+    const struct DECODERULE *rule;
     const struct OPERATION *op;
+    uint32_t opcode, bits;
+    uint8_t opstring[80];
+
+    memset(dop, 0, sizeof(struct TM32OP));
+    dop->size = opsize;
+    dop->opindex = opindex(decodeop(255));                  // nop, until decoded otherwise
+    dop->property = NOPROP;
 
     if(opint64 == 0)
-        sprintf(opstring, "IF r1   nop");
+        dop->form = FORM_NOP;
+    else if(opsize % 8 || opsize / 8 >= 6 || !(dop->sizeclass = sizeclasses[opsize / 8][OPBITS33_32(opint64)]))
+        dop->form = FORM_BADSIZE;
+    else {
+        opcode = opcodefields[dop->sizeclass].base + (opint64 >> opcodefields[dop->sizeclass].shift & opcodefields[dop->sizeclass].mask);
+        op = decodeop(opcode);
+        if(opcodefields[dop->sizeclass].tracename)
+            TRACE(ctx, TRACE_DECODE, "%s= %d = %s\n", opcodefields[dop->sizeclass].tracename, opcode, op->opname);
+
+        rule = &decoderules[dop->sizeclass][op->property];
+        dop->opindex = opindex(op);
+        dop->property = op->property;
+        if(rule->guard == FIELD_NONE)
+            dop->form = FORM_ILLEGAL;
+        else {
+            dop->form = rule->form;
+            dop->guard = GETFIELD(opint64, rule->guard);
+            dop->src1 = GETFIELD(opint64, rule->src1);
+            dop->src2 = GETFIELD(opint64, rule->src2);
+            dop->dst = GETFIELD(opint64, rule->dst);
+            switch(rule->param) {                           // the one place parameters are sign extended and scaled
+                case PARAM_7:
+                    bits = GETFIELD(opint64, rule->paramfield);
+                    dop->param = op->paramfactor * (op->sign == SIGNED ? signextend(bits) : (int32_t) bits);
+                    break;
+                case PARAM_7SIGNED:
+                    dop->param = op->paramfactor * signextend(GETFIELD(opint64, rule->paramfield));
+                    break;
+                case PARAM_32:
+                    dop->param = PARAM32BITS(opint64);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    if(TRACING(ctx, TRACE_DECODE)) {
+        renderoperation(opstring, dop);
+        fprintf(ctx->traceout, "OPBITS[6:0]       = %d \n", OPBITS6_0(opint64));
+        fprintf(ctx->traceout, "OPBITS[13:7]      = %d \n", OPBITS13_7(opint64));
+        fprintf(ctx->traceout, "OPBITS[20:14]     = %d \n", OPBITS20_14(opint64));
+        fprintf(ctx->traceout, "OPBITS[28:21]     = %d \n", OPBITS28_21(opint64));
+        fprintf(ctx->traceout, "OPBITS[29]        = %d \n", OPBITS29(opint64));
+        fprintf(ctx->traceout, "OPBITS[32:26]     = %d\n", OPBITS32_26(opint64));
+        fprintf(ctx->traceout, "OPBITS[33:32:31]  = %x:%x:%x\n", OPBITS33(opint64), OPBITS32(opint64), OPBITS31(opint64));
+        fprintf(ctx->traceout, "OPBITS[41:35]     = %d\n", OPBITS41_35(opint64));
+        fprintf(ctx->traceout, "opstring          = %s\n\n", opstring);
+    }
+
+    return opint64;
+}
+
+// setop() fills in a decoded operation structure
+static void setop(struct TM32OP *dop, enum OPFORM form, uint32_t guard, const struct OPERATION *op,
+                        int32_t param, uint32_t src1, uint32_t src2, uint32_t dst) {
+    dop->opindex = opindex(op);
+    dop->property = op->property;
+    dop->form = form;
+    dop->guard = guard;
+    dop->src1 = src1;
+    dop->src2 = src2;
+    dop->dst = dst;
+    dop->param = param;
+}
+
+#define PARAM7(op, bits)    ((op)->paramfactor * ((op)->sign==SIGNED ? signextend(bits) : (bits)))
+
+// decodeoperationswitch() is the reference decoder that decodeoperation() replaced: a nested switch
+// on the operation size, the type bits and the property of the opcode. It is kept for --selftest
+static void decodeoperationswitch(uint32_t opsize, uint64_t opint64, struct TM32OP *dop) {
+    const struct OPERATION *op;
+
+    memset(dop, 0, sizeof(struct TM32OP));
+    dop->size = opsize;
+    dop->opindex = opindex(decodeop(255));                  // nop, until decoded otherwise
+    dop->property = NOPROP;
+
+    if(opint64 == 0)
+        dop->form = FORM_NOP;
     else {
       switch (opsize) {
         case 24 :
+            dop->sizeclass = OPCLASS_26;
             op = decodeop(OPBITS25_21(opint64));
-            fprintf(debugout, "26:opcode[4:0]    = %d = %s\n", OPBITS25_21(opint64), op->opname);
             switch(op->property) {
                 case BINARY_UNGUARDED_SHORT:
                 case BINARY_SHORT:
-                    sprintf(opstring,"IF r%-3d %s r%d r%d -> r%d", 
-                        1, op->opname, OPBITS6_0(opint64), OPBITS13_7(opint64), OPBITS20_14(opint64));
+                    setop(dop, FORM_BINARY, 1, op, 0, OPBITS6_0(opint64), OPBITS13_7(opint64), OPBITS20_14(opint64));
                     break;
                 case UNARY_PARAM7_UNGUARDED_SHORT:
                 case UNARY_PARAM7_SHORT:
-                    sprintf(opstring,"IF r%-3d %s(%d) r%d -> r%d", 
-                        1, op->opname, op->paramfactor * (op->sign==SIGNED ? signextend(OPBITS13_7(opint64)) : OPBITS13_7(opint64)), 
-                        OPBITS6_0(opint64), OPBITS20_14(opint64));
+                    setop(dop, FORM_PARAM_UNARY, 1, op, PARAM7(op, OPBITS13_7(opint64)),
+                        OPBITS6_0(opint64), 0, OPBITS20_14(opint64));
                     break;
                 case BINARY_UNGUARDED_PARAM7_RESULTLESS_SHORT:
                 case BINARY_PARAM7_RESULTLESS_SHORT:
-                    sprintf(opstring,"IF r%-3d %s(%d) r%d r%d", 
-                        1, op->opname, op->paramfactor * signextend(OPBITS20_14(opint64)), OPBITS6_0(opint64), OPBITS13_7(opint64));
+                    setop(dop, FORM_PARAM_BINARY_RESULTLESS, 1, op, op->paramfactor * signextend(OPBITS20_14(opint64)),
+                        OPBITS6_0(opint64), OPBITS13_7(opint64), 0);
                     break;
                 case UNARY_SHORT:
-                    sprintf(opstring,"IF r%-3d %s r%d -> r%d", 
-                        OPBITS20_14(opint64), op->opname, OPBITS6_0(opint64), OPBITS13_7(opint64));
+                    setop(dop, FORM_UNARY, OPBITS20_14(opint64), op, 0, OPBITS6_0(opint64), 0, OPBITS13_7(opint64));
                     break;
                 default:
-                    sprintf(opstring,"26: ILLEGAL OP! = %s", op->opname);
+                    setop(dop, FORM_ILLEGAL, 0, op, 0, 0, 0, 0);
             }
             break;
         case 32 :
             switch(OPBITS33(opint64)) {     // bit 33 identies short or long opcode
                 case 0: // short opcode
+                    dop->sizeclass = OPCLASS_34SHORT;
                     op = decodeop(OPBITS25_21(opint64));
-                    fprintf(debugout, "34-0:opcode[4:0]  = %d = %s\n", OPBITS25_21(opint64), op->opname);
                     switch(op->property) {
                         case BINARY_UNGUARDED_SHORT:
                         case BINARY_SHORT:
-                                sprintf(opstring,"IF r%-3d %s r%d r%d -> r%d", OPBITS20_14(opint64), op->opname,
-                                 OPBITS6_0(opint64), OPBITS13_7(opint64), OPBITS32_26(opint64));
+                            setop(dop, FORM_BINARY, OPBITS20_14(opint64), op, 0,
+                                OPBITS6_0(opint64), OPBITS13_7(opint64), OPBITS32_26(opint64));
                             break;
                         case UNARY_SHORT:
-                                sprintf(opstring,"IF r%-3d %s r%d -> r%d",  OPBITS20_14(opint64), op->opname, 
-                                OPBITS6_0(opint64), OPBITS32_26(opint64));
+                            setop(dop, FORM_UNARY, OPBITS20_14(opint64), op, 0, OPBITS6_0(opint64), 0, OPBITS32_26(opint64));
                             break;
                         case UNARY_PARAM7_UNGUARDED_SHORT:
                         case UNARY_PARAM7_SHORT:
-                            sprintf(opstring,"IF r%-3d %s(%d) r%d -> r%d",  OPBITS20_14(opint64), op->opname, 
-                                op->paramfactor * (op->sign==SIGNED ? signextend(OPBITS13_7(opint64)) : OPBITS13_7(opint64)),
-                                OPBITS6_0(opint64), OPBITS32_26(opint64));
+                            setop(dop, FORM_PARAM_UNARY, OPBITS20_14(opint64), op, PARAM7(op, OPBITS13_7(opint64)),
+                                OPBITS6_0(opint64), 0, OPBITS32_26(opint64));
                             break;
                         case BINARY_UNGUARDED_PARAM7_RESULTLESS_SHORT:
                         case BINARY_PARAM7_RESULTLESS_SHORT:
-                            sprintf(opstring,"IF r%-3d %s(%d) r%d r%d", OPBITS20_14(opint64), op->opname, 
-                                op->paramfactor * (op->sign==SIGNED ? signextend(OPBITS32_26(opint64)) : OPBITS32_26(opint64)),
-                                OPBITS6_0(opint64), OPBITS13_7(opint64));
+                            setop(dop, FORM_PARAM_BINARY_RESULTLESS, OPBITS20_14(opint64), op, PARAM7(op, OPBITS32_26(opint64)),
+                                OPBITS6_0(opint64), OPBITS13_7(opint64), 0);
                             break;
                         default:
-                            sprintf(opstring,"34-0: ILLEGAL OP! = %s", op->opname);
+                            setop(dop, FORM_ILLEGAL, 0, op, 0, 0, 0, 0);
                             break;
                     }
                     break;
                 case 1:     // OPTBITS33 == 1 == long opcode in 34-bits
+                    dop->sizeclass = OPCLASS_34LONG;
                     op = decodeop(OPBITS28_21(opint64));
-                    fprintf(debugout, "34-1:opcode[7:0]  = %d = %s\n", OPBITS28_21(opint64), op->opname);
 
                         switch(op->property) {
                             case BINARY_UNGUARDED:
-                                sprintf(opstring,"IF r%-3d %s r%d r%d -> r%d", 
-                                    1, op->opname, OPBITS6_0(opint64), OPBITS13_7(opint64), OPBITS20_14(opint64));
-                                break;
                             case BINARY:
-                                sprintf(opstring,"IF r%-3d %s r%d r%d -> r%d", 
-                                    1, op->opname, OPBITS6_0(opint64), OPBITS13_7(opint64), OPBITS20_14(opint64));
+                                setop(dop, FORM_BINARY, 1, op, 0, OPBITS6_0(opint64), OPBITS13_7(opint64), OPBITS20_14(opint64));
                                 break;
                             case BINARY_RESULTLESS:
-                                sprintf(opstring,"IF r%-3d %s r%d r%d", 
-                                    OPBITS20_14(opint64), op->opname, OPBITS6_0(opint64), OPBITS13_7(opint64));
+                                setop(dop, FORM_BINARY_RESULTLESS, OPBITS20_14(opint64), op, 0,
+                                    OPBITS6_0(opint64), OPBITS13_7(opint64), 0);
                                 break;
                             case UNARY_PARAM7:
-                                sprintf(opstring,"IF r%-3d %s(%d) r%d -> r%d", 
-                                    OPBITS20_14(opint64), op->opname, 
-                                    op->paramfactor * (op->sign==SIGNED ? signextend(OPBITS13_7(opint64)) : OPBITS13_7(opint64)),
-                                    OPBITS6_0(opint64), OPBITS20_14(opint64));
+                                setop(dop, FORM_PARAM_UNARY, OPBITS20_14(opint64), op, PARAM7(op, OPBITS13_7(opint64)),
+                                    OPBITS6_0(opint64), 0, OPBITS20_14(opint64));
                                 break;                          
                             case UNARY_PARAM7_UNGUARDED:
-                                sprintf(opstring,"IF r%-3d %s(%d) r%d -> r%d", 
-                                    1, op->opname, 
-                                    op->paramfactor * (op->sign==SIGNED ? signextend(OPBITS13_7(opint64)) : OPBITS13_7(opint64)),
-                                    OPBITS6_0(opint64), OPBITS20_14(opint64));
+                                setop(dop, FORM_PARAM_UNARY, 1, op, PARAM7(op, OPBITS13_7(opint64)),
+                                    OPBITS6_0(opint64), 0, OPBITS20_14(opint64));
                                 break;                          
                             case UNARY: // case UNARY_SHORT:
-                                sprintf(opstring,"IF r%-3d %s r%d -> r%d", 
-                                    OPBITS20_14(opint64), op->opname, OPBITS6_0(opint64), OPBITS13_7(opint64));             
+                                setop(dop, FORM_UNARY, OPBITS20_14(opint64), op, 0, OPBITS6_0(opint64), 0, OPBITS13_7(opint64));
                                 break;
                             case UNARY_PARAM7_RESULTLESS:
-                                sprintf(opstring,"IF r%-3d %s(%d) r%d", 
-                                    OPBITS20_14(opint64), op->opname, 
-                                    op->paramfactor * (op->sign==SIGNED ? signextend(OPBITS13_7(opint64)) : OPBITS13_7(opint64)),
-                                    OPBITS6_0(opint64));
+                                setop(dop, FORM_PARAM_UNARY_RESULTLESS, OPBITS20_14(opint64), op, PARAM7(op, OPBITS13_7(opint64)),
+                                    OPBITS6_0(opint64), 0, 0);
                                 break;
                             case ZEROARY_RESULTLESS:
-                                sprintf(opstring,"IF r%-3d %s", 
-                                    OPBITS20_14(opint64), op->opname);
+                                setop(dop, FORM_ZEROARY_RESULTLESS, OPBITS20_14(opint64), op, 0, 0, 0, 0);
                                 break;
                             default:
-                                sprintf(opstring,"34-1: ILLEGAL OP! = %s", op->opname);
+                                setop(dop, FORM_ILLEGAL, 0, op, 0, 0, 0, 0);
                                 break;
                         }
                     break;
@@ -152,126 +490,160 @@ uint64_t decodeoperation(uint32_t opsize, uint64_t opint64, uint8_t *opstring) {
         case 40 : 
             switch(OPBITS33(opint64)) 
                 case 1:{        // when set, bit 33 identifies <zeroary_param32> e.g. iimm/uimm
+                    dop->sizeclass = OPCLASS_42IMM;
                     op = decodeop(191);
-                    sprintf(opstring,"IF r%-3d %s(0x%x) -> r%d", 1, op->opname, 
-                        PARAM32BITS(opint64), OPBITS20_14(opint64));
+                    setop(dop, FORM_PARAM32, 1, op, PARAM32BITS(opint64), 0, 0, OPBITS20_14(opint64));
                     break;
                 case 0:         // when not set, bit 33 identifies <zeroary_param32_resultless> e.g. jmpi/ijmpi
                                 
                     if (!(OPBITS33(opint64)) && !(OPBITS32(opint64))) { 
+                        dop->sizeclass = OPCLASS_42JUMP;
                         op = (OPBITS31(opint64)) ? decodeop(179) : decodeop(178); 
                                 // if bit 31 (signed flag) is set
                                 // zeroary_param32_resultless (signed) == jmpi
                                 // else .._param32_resultless(unsigned)== ijmpi
-                        sprintf(opstring,"IF r%-3d %s(0x%x)", 
-                            OPBITS20_14(opint64), op->opname, PARAM32BITS(opint64));
+                        setop(dop, FORM_PARAM32_RESULTLESS, OPBITS20_14(opint64), op, PARAM32BITS(opint64), 0, 0, 0);
                     }                                                               
                     else {                  // a long opcode operation taking 42-bits
+                        dop->sizeclass = OPCLASS_42LONG;
                         op = decodeop(OPBITS28_21(opint64));
-                        fprintf(debugout, "42:opcode[7:0]    = %d = %s\n", OPBITS28_21(opint64), op->opname);
                         switch(op->property) {
                             case BINARY_UNGUARDED_SHORT:
-                                sprintf(opstring,"IF r%-3d %s r%d r%d -> r%d", 
-                                    1, op->opname, OPBITS6_0(opint64), OPBITS13_7(opint64), OPBITS41_35(opint64));
+                            case BINARY_UNGUARDED:
+                                setop(dop, FORM_BINARY, 1, op, 0, OPBITS6_0(opint64), OPBITS13_7(opint64), OPBITS41_35(opint64));
                                 break;
                             case UNARY_PARAM7_UNGUARDED_SHORT:
-                                sprintf(opstring,"IF r%-3d %s(%d) r%d -> r%d", 
-                                    1, op->opname, 
-                                    op->paramfactor * (op->sign==SIGNED ? signextend(OPBITS13_7(opint64)) : OPBITS13_7(opint64)),
-                                    OPBITS6_0(opint64), OPBITS41_35(opint64));
+                            case UNARY_PARAM7_UNGUARDED:
+                                setop(dop, FORM_PARAM_UNARY, 1, op, PARAM7(op, OPBITS13_7(opint64)),
+                                    OPBITS6_0(opint64), 0, OPBITS41_35(opint64));
                                 break;
                             case BINARY_UNGUARDED_PARAM7_RESULTLESS_SHORT:
-                                sprintf(opstring,"IF r%-3d %s(%d) r%d r%d",
-                                    1, op->opname, 
-                                    op->paramfactor * (op->sign==SIGNED ? signextend(OPBITS41_35(opint64)) : OPBITS41_35(opint64)), 
-                                    OPBITS6_0(opint64), OPBITS13_7(opint64));
+                                setop(dop, FORM_PARAM_BINARY_RESULTLESS, 1, op, PARAM7(op, OPBITS41_35(opint64)),
+                                    OPBITS6_0(opint64), OPBITS13_7(opint64), 0);
                                 break;
                             case UNARY_SHORT:
-                                sprintf(opstring,"IF r%-3d %s r%d -> r%d", 
-                                    OPBITS20_14(opint64), op->opname, OPBITS6_0(opint64), OPBITS41_35(opint64));
+                            case UNARY:
+                                setop(dop, FORM_UNARY, OPBITS20_14(opint64), op, 0, OPBITS6_0(opint64), 0, OPBITS41_35(opint64));
                                 break;
                             case BINARY_SHORT:
-                                sprintf(opstring,"IF r%-3d %s r%d r%d -> r%d", 
-                                    OPBITS20_14(opint64), op->opname, OPBITS6_0(opint64), OPBITS13_7(opint64), OPBITS41_35(opint64));
+                            case BINARY:
+                                setop(dop, FORM_BINARY, OPBITS20_14(opint64), op, 0,
+                                    OPBITS6_0(opint64), OPBITS13_7(opint64), OPBITS41_35(opint64));
                                 break;
                             case UNARY_PARAM7_SHORT:
-                                sprintf(opstring,"IF r%-3d %s(%d) r%d -> r%d", OPBITS20_14(opint64), op->opname, 
-                                    op->paramfactor * (op->sign==SIGNED ? signextend(OPBITS13_7(opint64)) : OPBITS13_7(opint64)),
-                                    OPBITS6_0(opint64), OPBITS41_35(opint64));
+                            case UNARY_PARAM7:
+                                setop(dop, FORM_PARAM_UNARY, OPBITS20_14(opint64), op, PARAM7(op, OPBITS13_7(opint64)),
+                                    OPBITS6_0(opint64), 0, OPBITS41_35(opint64));
                                 break;
                             case BINARY_PARAM7_RESULTLESS_SHORT:
-                                sprintf(opstring,"IF r%-3d %s(%d) r%d r%d", OPBITS20_14(opint64), op->opname, 
-                                    op->paramfactor * (op->sign==SIGNED ? signextend(OPBITS41_35(opint64)) : OPBITS41_35(opint64)),
-                                    OPBITS6_0(opint64), OPBITS13_7(opint64));
-                                break;
-                            case BINARY_UNGUARDED:
-                                sprintf(opstring,"IF r%-3d %s r%d r%d -> r%d", 
-                                    1, op->opname, OPBITS6_0(opint64), OPBITS13_7(opint64), OPBITS41_35(opint64));
-                                break;
-                            case BINARY_RESULTLESS:
-                                sprintf(opstring,"IF r%-3d %s r%d r%d", 
-                                    OPBITS20_14(opint64), op->opname, OPBITS6_0(opint64), OPBITS13_7(opint64));
-                                break;
-                            case UNARY_PARAM7_UNGUARDED:
-                                sprintf(opstring,"IF r%-3d %s(%d) r%d -> r%d", 
-                                    1, op->opname, op->paramfactor * (op->sign==SIGNED ? signextend(OPBITS13_7(opint64)) : OPBITS13_7(opint64)),
-                                    OPBITS6_0(opint64), OPBITS41_35(opint64));
-                                break;
-                            case UNARY:
-                                sprintf(opstring,"IF r%-3d %s r%d -> r%d", 
-                                    OPBITS20_14(opint64), op->opname, OPBITS6_0(opint64), OPBITS41_35(opint64));
-                                break;
                             case BINARY_PARAM7_RESULTLESS:
-                                sprintf(opstring,"IF r%-3d %s(%d) r%d r%d", OPBITS20_14(opint64), op->opname, 
-                                    op->paramfactor * (op->sign==SIGNED ? signextend(OPBITS41_35(opint64)) : OPBITS41_35(opint64)), 
-                                    OPBITS6_0(opint64), OPBITS13_7(opint64));
-                                break;
-                            case BINARY:
-                                sprintf(opstring,"IF r%-3d %s r%d r%d -> r%d", 
-                                    OPBITS20_14(opint64), op->opname, OPBITS6_0(opint64), OPBITS13_7(opint64), OPBITS41_35(opint64));
+                                setop(dop, FORM_PARAM_BINARY_RESULTLESS, OPBITS20_14(opint64), op, PARAM7(op, OPBITS41_35(opint64)),
+                                    OPBITS6_0(opint64), OPBITS13_7(opint64), 0);
                                 break;
-                            case UNARY_PARAM7:
-                                sprintf(opstring,"IF r%-3d %s(%d) r%d -> r%d", OPBITS20_14(opint64), op->opname, 
-                                    op->paramfactor * (op->sign==SIGNED ? signextend(OPBITS13_7(opint64)) : OPBITS13_7(opint64)),
-                                    OPBITS6_0(opint64), OPBITS41_35(opint64));
+                            case BINARY_RESULTLESS:
+                                setop(dop, FORM_BINARY_RESULTLESS, OPBITS20_14(opint64), op, 0,
+                                    OPBITS6_0(opint64), OPBITS13_7(opint64), 0);
                                 break;
                             case UNARY_PARAM7_RESULTLESS:
-                                sprintf(opstring,"IF r%-3d %s(%d) r%d", OPBITS20_14(opint64), op->opname, 
-                                    op->paramfactor * (op->sign==SIGNED ? signextend(OPBITS13_7(opint64)) : OPBITS13_7(opint64)),
-                                    OPBITS6_0(opint64));
+                                setop(dop, FORM_PARAM_UNARY_RESULTLESS, OPBITS20_14(opint64), op, PARAM7(op, OPBITS13_7(opint64)),
+                                    OPBITS6_0(opint64), 0, 0);
                                 break;
                             case ZEROARY:
-                                sprintf(opstring,"IF r%-3d %s -> %d", OPBITS20_14(opint64), op->opname, OPBITS41_35(opint64));
+                                setop(dop, FORM_ZEROARY, OPBITS20_14(opint64), op, 0, 0, 0, OPBITS41_35(opint64));
                                 break;
                             case ZEROARY_RESULTLESS:
-                                sprintf(opstring,"IF r%-3d %s", OPBITS20_14(opint64), op->opname);
+                                setop(dop, FORM_ZEROARY_RESULTLESS, OPBITS20_14(opint64), op, 0, 0, 0, 0);
                                 break;
                             case UNARY_RESULTLESS:
-                                sprintf(opstring,"IF r%-3d %s %d", OPBITS20_14(opint64), op->opname, OPBITS6_0(opint64));
+                                setop(dop, FORM_UNARY_RESULTLESS, OPBITS20_14(opint64), op, 0, OPBITS6_0(opint64), 0, 0);
                                 break;
                             default:
-                                sprintf(opstring,"42: ILLEGAL OP! = %s", op->opname);
+                                setop(dop, FORM_ILLEGAL, 0, op, 0, 0, 0, 0);
                         } // end of switch(op->property) {
                     } // else
                 break;
             }   // case 40
             break;
         default :
-            sprintf(opstring,"Unknown operation size: %d", opsize);
+            dop->form = FORM_BADSIZE;
        }
     }
+}
 
-    fprintf(debugout, "OPBITS[6:0]       = %d \n", OPBITS6_0(opint64));
-    fprintf(debugout, "OPBITS[13:7]      = %d \n", OPBITS13_7(opint64));
-    fprintf(debugout, "OPBITS[20:14]     = %d \n", OPBITS20_14(opint64));
-    fprintf(debugout, "OPBITS[28:21]     = %d \n", OPBITS28_21(opint64));
-    fprintf(debugout, "OPBITS[29]        = %d \n", OPBITS29(opint64));
-    fprintf(debugout, "OPBITS[32:26]     = %d\n", OPBITS32_26(opint64));
-    fprintf(debugout, "OPBITS[33:32:31]  = %x:%x:%x\n", OPBITS33(opint64), OPBITS32(opint64), OPBITS31(opint64));
-    fprintf(debugout, "OPBITS[41:35]     = %d\n", OPBITS41_35(opint64));
-    fprintf(debugout, "opstring          = %s\n\n", opstring);
-    
-    return opint64;
+// checkdecodetable() compares decodeoperation() against the reference decodeoperationswitch(),
+// for every opcode of every size class, with random operand bits.
+// returns the count of operations that decode differently
+
+uint32_t checkdecodetable(void) {
+    static const uint32_t opsizes[] = { 0, 8, 24, 32, 40, 48 };
+    struct TM32OP dop, ref;
+    struct TM32CTX ctx;
+    uint64_t opint64;
+    uint32_t i, n, errors = 0;
+
+    memset(&ctx, 0, sizeof(ctx));                                   // no tracing
+    srand(0x1d2e);
+    for(i=0;i<sizeof(opsizes)/sizeof(opsizes[0]);i++)
+        for(n=0;n<(1 << 16);n++) {
+            opint64 = ((uint64_t) rand() << 30 ^ (uint64_t) rand() << 15 ^ rand()) & 0x3ffffffffffULL;
+            opint64 = (opint64 & ~(0xffULL << 21)) | (uint64_t) (n & 0xff) << 21;      // every opcode
+            if(opsizes[i] == 0)
+                opint64 = 0;
+            decodeoperation(&ctx, opsizes[i], opint64, &dop);
+            decodeoperationswitch(opsizes[i], opint64, &ref);
+            if(memcmp(&dop, &ref, sizeof(struct TM32OP))) {
+                if(errors++ < 8)
+                    fprintf(stdout, "decode mismatch: %d bits, operation 0x%011" PRIx64 "\n", opsizes[i] + 2, opint64);
+            }
+        }
+    return errors;
+}
+
+// decodeinstruction() unpacks and decodes the five operations of the instruction at instrptr, which
+// has the format field formatfield, into the structure ins
+void decodeinstruction(struct TM32CTX *ctx, uint8_t *instrptr, uint16_t formatfield, uint64_t offset, struct TM32INSTR *ins) {
+    const struct FORMATDESC *fd = GETFORMATDESC(formatfield);
+    uint32_t i;
+
+    ins->offset = offset;
+    ins->formatfield = formatfield;
+    ins->length = fd->inslength / 8;
+    memcpy(&ins->nextformatfield, instrptr, 2);                     // format field for the next instruction
+    if(TRACING(ctx, TRACE_UNPACK)) {                                // the per-slot unpacker traces each step
+        for(i=0;i<MAXSLOT;i++) {
+            ins->opbits[i] = unpackoperation(ctx, instrptr, formatfield, i);
+            decodeoperation(ctx, fd->opsize[i], ins->opbits[i], &ins->op[i]);
+        }
+        return;
+    }
+    unpackinstruction(instrptr, formatfield, ins->opbits);
+    for(i=0;i<MAXSLOT;i++)
+        decodeoperation(ctx, fd->opsize[i], ins->opbits[i], &ins->op[i]);
 }
 
+// instructionclean() returns TRUE if every operation of the decoded instruction ins is legal
+uint32_t instructionclean(const struct TM32INSTR *ins) {
+    uint32_t i;
 
+    for(i=0;i<MAXSLOT;i++)
+        if(ins->op[i].form == FORM_ILLEGAL || ins->op[i].form == FORM_BADSIZE)
+            return FALSE;
+    return TRUE;
+}
+
+// decodeinstructions() decodes the instruction stream in bytecount bytes at objbuf, which must begin
+// with a decision tree, into the flat array ins of up to maxcount instructions. offset is the address
+// of the first instruction. returns the count of instructions decoded
+uint64_t decodeinstructions(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t bytecount, uint64_t offset, struct TM32INSTR *ins, uint64_t maxcount) {
+    uint16_t formatfield = bswap_16(BRTARGETFORMATBYTES);
+    uint8_t *instrptr = objbuf;
+    uint64_t count = 0;
+
+    while(instrptr < objbuf + bytecount && count < maxcount) {
+        decodeinstruction(ctx, instrptr, formatfield, offset, &ins[count]);
+        instrptr += ins[count].length;
+        offset += ins[count].length;
+        formatfield = ins[count++].nextformatfield;
+    }
+    return count;
+}
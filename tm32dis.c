@@ -27,85 +27,264 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <unistd.h>
+#if defined(TM32_HAVE_PTHREAD)
+#include <pthread.h>
+#endif
 #include "tm32dis.h"
 #include "tm32disinstrs.h"
 
+static void tm32initonce(void) {
+    initformatdescs();
+    initopcodetable();
+    initmemimgkernel();
+}
 
-// tmdisassemble() iterates through a byte array for a count of bytecount,
-// and disassembles the TM32 instruction stream, using an arbitrary offset
-void tmdisassemble(uint32_t printoutformat, uint8_t *objbuf, uint64_t bytecount, uint64_t offset) {
+// tm32init() builds the shared, read-only decode tables. It is safe to call any number of times,
+// from any thread; only the first call does the work
+void tm32init(void) {
+#if defined(TM32_HAVE_PTHREAD)
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
 
-    uint16_t currentformatfield;
-    uint16_t nextformatfield = bswap_16(BRTARGETFORMATBYTES);       // start with an uncompressed branch target 
-                                                                    // instruction  (format bytes == 0xaa 0x02)
-    uint16_t inslength;                                             // an uncompressed TM32 instruction is 224 bits long:
-                                                                    //  16 + (3* 24) + 8 + (2* 24) + (5* 16);   
-    uint64_t opint64 = 0;                                           // a 64 bit integer to hold the current operation (or "syllable")
-    uint8_t *instrptr = objbuf;
-    static uint8_t formatbitstr[20], operationstring[50], currentinstruction[30], opsize = 0;
-    uint32_t i, insnum = 0;
-
-    currentformatfield = nextformatfield;                           // set the first format field to an instruction of 5 x 42-bits
-                                                                    // this is a branch target and has an uncompressed instruction
-    fprintf(stdout, "\ndisassembly\n");
-
-// -------------- main loop - iterate through instructions
-
-    while( (void *) instrptr < (void *) objbuf + bytecount) {
-
-        inslength = instructionlength(currentformatfield);
-        memcpy(currentinstruction, instrptr, inslength / 8);
-    
-        if(inslength == MAXTM32INSLEN) {                            // start of a new decision tree ... 
-            fprintf(stdout, "\n");                                  // it would be better here to check whether all the 
-            insnum = 0;                                             // operations are uncompressed - implying branch-in point
+    pthread_once(&once, tm32initonce);
+#else
+    tm32initonce();
+#endif
+}
+
+// tm32ctxinit() sets up a context to disassemble in output format printoutformat, with the text
+// written to file descriptor fd and tracing off. returns 0 on success, -1 if out of memory
+int32_t tm32ctxinit(struct TM32CTX *ctx, int32_t fd, uint32_t printoutformat) {
+    tm32init();
+    ctx->printoutformat = printoutformat;
+    ctx->threads = 1;
+    ctx->tracemask = 0;
+    ctx->resync = FALSE;
+    ctx->profile = NULL;
+    ctx->traceout = stderr;
+    return outinit(&ctx->out, fd, OUTBUFSIZE);
+}
+
+// tm32ctxfree() flushes any text still buffered in a context and releases its buffer
+void tm32ctxfree(struct TM32CTX *ctx) {
+    if(ctx->out.buf)
+        outfree(&ctx->out);
+}
+
+// putoperation() writes the text of the operation in slot number slot, followed by a comma (or a
+// semicolon after the last slot), indented and padded with spaces to width characters
+static uint8_t *putoperation(uint8_t *p, const struct TM32OP *dop, uint32_t slot, uint32_t width) {
+    uint8_t *field;
+
+    p = putstr(p, "   ");
+    field = p;
+    p = renderoperation(p, dop);
+    *p++ = (slot == MAXSLOT-1) ? ';' : ',';
+    return putpad(p, field, width);
+}
+
+// putbinheader() writes the header that starts -f bin output. returns a pointer to its end
+uint8_t *putbinheader(uint8_t *p) {
+    memcpy(p, "TM32BIN", 8);
+    p = putle(p + 8, BINVERSION, 2);
+    p = putle(p, BINRECORDBYTES, 2);
+    return putle(p, 0, 4);
+}
+
+// putdisassemblystart() and putdisassemblyend() write the lines around a disassembly, which
+// only the text formats have
+uint8_t *putdisassemblystart(const struct TM32CTX *ctx, uint8_t *p) {
+    return MACHINEFORMAT(ctx->printoutformat) ? p : putstr(p, "\ndisassembly\n");
+}
+
+uint8_t *putdisassemblyend(const struct TM32CTX *ctx, uint8_t *p) {
+    return MACHINEFORMAT(ctx->printoutformat) ? p : putstr(p, "\nend disassembly\n");
+}
+
+// renderjson() renders the decoded instruction ins as one line of JSON. returns a pointer to its end
+static uint8_t *renderjson(uint8_t *p, const struct TM32INSTR *ins, uint32_t insnum) {
+    uint32_t i;
+
+    p = putstr(p, "{\"address\":");
+    p = putudec64(p, ins->offset);
+    p = putstr(p, ",\"length\":");
+    p = putudec(p, ins->length);
+    p = putstr(p, ",\"format\":");
+    p = putudec(p, bswap_16(ins->formatfield) & 0xff03);
+    p = putstr(p, (ins->length * 8 == MAXTM32INSLEN) ? ",\"tree\":true" : ",\"tree\":false");
+    p = putstr(p, ",\"insnum\":");
+    p = putudec(p, insnum);
+    p = putstr(p, ",\"ops\":[");
+    for(i=0;i<MAXSLOT;i++) {
+        if(i)
+            *p++ = ',';
+        p = renderoperationjson(p, &ins->op[i]);
+    }
+    return putstr(p, "]}\n");
+}
+
+// renderbin() packs the decoded instruction ins into one -f bin record. returns a pointer to its end
+static uint8_t *renderbin(uint8_t *p, const struct TM32INSTR *ins, uint32_t insnum) {
+    const struct TM32OP *dop;
+    uint32_t i, flags = 0;
+
+    if(ins->length * 8 == MAXTM32INSLEN)
+        flags |= BINFLAG_TREE;
+    if(!instructionclean(ins))
+        flags |= BINFLAG_ILLEGAL;
+    p = putle(p, ins->offset, 8);
+    p = putle(p, bswap_16(ins->formatfield) & 0xff03, 2);
+    *p++ = ins->length;
+    *p++ = flags;
+    p = putle(p, insnum, 4);
+    for(i=0;i<MAXSLOT;i++) {
+        dop = &ins->op[i];
+        p = putle(p, oplist[dop->opindex].opcode, 2);
+        *p++ = dop->form;
+        *p++ = dop->guard;
+        *p++ = dop->src1;
+        *p++ = dop->src2;
+        *p++ = dop->dst;
+        *p++ = dop->size;
+        p = putle(p, (uint32_t) dop->param, 4);
+    }
+    return putle(p, 0, BINRECORDBYTES - 16 - MAXSLOT * BINOPBYTES);
+}
+
+// renderinstruction() renders the decoded instruction ins in output format printoutformat, at p.
+// instrptr points to the instruction bytes, and insnum is its index in the decision tree.
+// returns a pointer to the end of the text
+uint8_t *renderinstruction(uint8_t *p, uint32_t printoutformat, const struct TM32INSTR *ins, const uint8_t *instrptr, uint32_t insnum) {
+    uint16_t nextformatfield = bswap_16(ins->nextformatfield);
+    uint8_t *field, opsize;
+    uint32_t i;
+
+    if(printoutformat == OUTFORMAT_JSON)
+        return renderjson(p, ins, insnum);
+    if(printoutformat == OUTFORMAT_BIN)
+        return renderbin(p, ins, insnum);
+
+    if(ins->length * 8 == MAXTM32INSLEN)                            // an empty line before each decision tree
+        *p++ = '\n';
+
+    switch(printoutformat) {
+        case 1:
+            p = putstr(p, "(* 0x");
+            p = puthex(p, ins->offset, 8);
+            p = putstr(p, " *) ");
+            for(i=0;i<MAXSLOT;i++)
+                p = putoperation(p, &ins->op[i], i, 36);
+            *p++ = '\n';
+            break; 
+        case 0:
+        default:
+            p = putstr(p, "(* instruction ");
+            field = p;
+            p = putpad(putudec(p, insnum), field, 3);
+            p = putstr(p, " : ");
+            p = putudec(p, ins->length * 8);
+            p = putstr(p, " bits (");
+            p = putudec(p, ins->length);
+            p = putstr(p, " bytes) long *)\n(* offset          : 0x");
+            p = puthex(p, ins->offset, 8);
+            p = putstr(p, " *)\n(* bytes           : ");
+            for(i=0;i<ins->length;i++) {
+                p = puthex(p, instrptr[i], 2);
+                *p++ = ' ';
+            }
+            p = putstr(p, "*)\n(* format bytes    : 0x");
+            p = puthex(p, nextformatfield, 4);
+            p = putstr(p, " & 0xff03 = 0x");
+            p = puthex(p, nextformatfield & 0xff03, 4);
+            p = putstr(p, ", format in little endian bit order: ");
+            p = putformatfield(p, ins->nextformatfield);
+            p = putstr(p, " *)\n");
+
+                                                                    // print each of the five ops in an instruction
+            for(i=0;i<MAXSLOT;i++) {                                      
+                opsize = ins->op[i].size;
+                p = putoperation(p, &ins->op[i], i, 33);
+                p = putstr(p, "           (* ");
+                p = (opsize == 0) ? putstr(p, " 0") : putudec(p, opsize+2);
+                p = putstr(p, " bits:");
+                p = putopint(p, ins->opbits[i], opsize);
+                p = putstr(p, " *)\n");
+            }
+            *p++ = '\n';
+    }
+    return p;
+}
+
+// disassemblespan() renders the instructions of span in objbuf as text at p, in the output buffer
+// out. span is left holding the state of the format field chain after its last instruction, from
+// which the stream can be continued. With ctx->resync, an instruction that does not decode and the
+// bytes after it are listed as data, up to the decision tree that resyncsearch() picks to restart at.
+// returns a pointer to the end of the text
+uint8_t *disassemblespan(struct TM32CTX *ctx, struct OUTBUF *out, uint8_t *p, uint8_t *objbuf, struct TM32SPAN *span) {
+
+    struct TM32INSTR ins;
+    uint16_t currentformatfield = span->formatfield;
+    uint8_t *instrptr = objbuf + span->start;
+    uint64_t offset = span->offset;
+    uint32_t insnum = span->insnum;
+    uint64_t restart;
+
+    while(instrptr < objbuf + span->end) {
+        p = outsync(out, p);
+        decodeinstruction(ctx, instrptr, currentformatfield, offset, &ins);
+
+        if(ctx->resync && !instructionclean(&ins)) {
+            restart = resyncsearch(ctx, objbuf, instrptr - objbuf + 1, span->end, offset - (instrptr - objbuf));
+            if(!MACHINEFORMAT(ctx->printoutformat))
+                p = putskippeddata(out, p, instrptr, objbuf + restart - instrptr, offset);
+            offset += objbuf + restart - instrptr;
+            instrptr = objbuf + restart;
+            currentformatfield = bswap_16(BRTARGETFORMATBYTES);
+            continue;
         }
-        else
+
+        if(ins.length * 8 == MAXTM32INSLEN)                         // start of a new decision tree ... 
+            insnum = 0;                                             // it would be better here to check whether all the 
+        else                                                        // operations are uncompressed - implying branch-in point
             insnum++;
 
-        memcpy(&nextformatfield, currentinstruction, 2);            // format field for the next instruction
-
-        switch(printoutformat) {
-            case 1:
-                fprintf(stdout, "(* 0x%08" PRIx64 " *) ", offset);   
-                instrptr += inslength/8;
-                for(i=0;i<5;i++) {                                      
-                    opint64 = (uint64_t) unpackoperation(currentinstruction, currentformatfield, i);
-                    opsize = operationsize(currentformatfield, i);
-                    decodeoperation(opsize, opint64, operationstring);
-                    strcat(operationstring, (i == 4) ? ";" : ",");
-                    fprintf(stdout, "   %-36s", operationstring);
-                }
-                fprintf(stdout, "\n");
-                break; 
-            case 0:
-            default:
-                fprintf(stdout, "(* instruction %-3d : %d bits (%d bytes) long *)\n", insnum, inslength, inslength / 8);
-                fprintf(stdout, "(* offset          : 0x%08" PRIx64 " *)\n", offset);
-                fprintf(stdout, "(* bytes           : ");
-                for(i=0;i<(inslength/8);i++) 
-                    fprintf(stdout,"%02x ", (uint8_t) *instrptr++);
-                fprintf(stdout, "*)\n");
-    
-                fprintf(stdout, "(* format bytes    : 0x%02x%02x & 0xff03 = ",  (uint8_t)(bswap_16(nextformatfield) >> 8) & 0xff,
-                                                                                (uint8_t)bswap_16(nextformatfield) & 0xff);
-                fprintf(stdout, "0x%04x, ", bswap_16(nextformatfield) & 0xff03);
-                fprintf(stdout, "format in little endian bit order: %s *)\n", formatfieldstring(nextformatfield));
-
-                                                                    // print each of the five ops in an instruction to stdout
-                for(i=0;i<5;i++) {                                      
-                    opint64 = (uint64_t) unpackoperation(currentinstruction, currentformatfield, i);
-                    opsize = operationsize(currentformatfield, i);
-                    decodeoperation(opsize, opint64, operationstring);
-                    strcat(operationstring, (i == 4) ? ";" : ",");
-                    fprintf(stdout, "   %-33s", operationstring);
-                    fprintf(stdout, "           (* %2d bits:%s *)\n", (opsize == 0 ? 0 : opsize+2), opintstr(opint64,opsize));
-                }
-                fprintf(stdout, "\n");
-            }
+        p = renderinstruction(p, ctx->printoutformat, &ins, instrptr, insnum);
 
-        offset += inslength / 8 ;
-        currentformatfield = nextformatfield;
+        instrptr += ins.length;
+        offset += ins.length;
+        currentformatfield = ins.nextformatfield;
     }
-    fprintf(stdout,"\nend disassembly\n");
+    span->start = instrptr - objbuf;
+    span->offset = offset;
+    span->formatfield = currentformatfield;
+    span->insnum = insnum;
+    return p;
+}
+
+// tmdisassemble() iterates through a byte array for a count of bytecount,
+// and disassembles the TM32 instruction stream, using an arbitrary offset.
+// The text goes to the output buffer of ctx, which is flushed at the end
+void tmdisassemble(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t bytecount, uint64_t offset) {
+
+    struct OUTBUF *out = &ctx->out;
+    struct TM32SPAN span = { 0, bytecount, offset, 0, 0 };
+    uint8_t *p;
+
+    span.formatfield = bswap_16(BRTARGETFORMATBYTES);               // start with an uncompressed branch target 
+                                                                    // instruction  (format bytes == 0xaa 0x02)
+    if(TRACING(ctx, TRACE_ALL))                                     // trace output may share the stream through stdio, so
+        out->flushlimit = 0;                                        // flush after every instruction to keep the two in order
+
+    p = putdisassemblystart(ctx, out->buf + out->len);
+
+    if(ctx->profile)                                                // the stages are timed on one thread
+        p = disassembleprofiled(ctx, out, p, objbuf, &span);
+    else if(ctx->threads > 1 && !TRACING(ctx, TRACE_ALL))           // trace output from several threads would interleave
+        p = disassemblethreaded(ctx, p, objbuf, bytecount, offset);
+    else
+        p = disassemblespan(ctx, out, p, objbuf, &span);
+
+    p = putdisassemblyend(ctx, p);
+    out->len = p - out->buf;
+    outflush(out);
 }   
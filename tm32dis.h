@@ -60,6 +60,7 @@
 #define OPBITS32(x)     (uint32_t)((x >> 32) & 1)       //
 #define OPBITS31(x)     (uint32_t)((x >> 31) & 1)       //
 #define OPBITS32_31(x)  (uint32_t)((x >> 31) & 3)       //
+#define OPBITS33_32(x)  (uint32_t)((x >> 32) & 3)       //   the type bits that select the size class of an operation
 #define OPBITS29(x)     (uint32_t)((x >> 29) & 1)       //   sign flag for 7-bit parameteric operations
 
 #define PARAM32BITS(x)  (uint32_t)(((x>>7) & 0x7f) | ((x<<7) & 0x7f<<7) | ((x>>7) & 0x3ff<<14) | ((x>>10) & 0xff<<24))
@@ -75,22 +76,322 @@
                                                         //   Branch Target Instruction -  they indicate the
                                                         //   beginning of a Decision Tree. The 'dtree' is
                                                         //   the scheduling unit for a Trimedia TM32 VLIW core.
-FILE *debugout;
+#define FORMATDESCCOUNT 1024                            //   one descriptor for each value of the 10-bit format field
+#define FORMATDESCMASK  0x3ff
+
+// struct FORMATDESC holds everything that can be derived from the 10-bit format field of an
+// instruction, so that the decode pipeline never has to loop over the issue-slots to find it.
+// Offsets are in bytes from the start of the instruction (i.e. they include the two format bytes)
+
+struct FORMATDESC {
+    uint16_t inslength;                                 //   total instruction length in bits
+    uint8_t opcount;                                    //   count of non-NOP operations
+    uint8_t opsize[MAXSLOT];                            //   compressed operation size in bits (0, 24, 32 or 40)
+    uint8_t insoffset[MAXSLOT];                         //   byte offset of the 24-bit part of each operation
+    uint8_t extoffset[MAXSLOT];                         //   byte offset of the 1 or 2 byte extension (2, the
+                                                        //   offset just past the format bytes, if none)
+    uint8_t realopindex[MAXSLOT];                       //   index of the operation among the non-NOP operations
+    uint8_t group2[MAXSLOT];                            //   TRUE if opcode bits [25:24] are in the 2nd group format byte
+    uint8_t fmtshift[MAXSLOT];                          //   right shift of opcode bits [25:24] in that format byte
+};
+
+extern struct FORMATDESC formatdescs[FORMATDESCCOUNT];
+
+#define GETFORMATDESC(formatbits)   (&formatdescs[(formatbits) & FORMATDESCMASK])
+
+#define OBJPADDING      64                              //   zero bytes readable past the end of an object file, enough
+                                                        //   for one instruction plus one memory image block
+
+#define MEMIMGBLOCK     32                              //   bytes in each bit-striped memory image block
+
+// MEMIMGBYTES() is the count of bytes of a memory image to transpose, for count bytes of instructions.
+// It takes whole blocks and covers the bytes read by an instruction that starts just before the end
+#define MEMIMGBYTES(count)  ((((count) + MAXTM32INSLEN / 8) / MEMIMGBLOCK + 1) * MEMIMGBLOCK)
+
+// struct OBJIMAGE describes an object file that is mapped into memory (or, where mmap() is not
+// available, the window of it that was read into a buffer)
+
+struct OBJIMAGE {
+    uint64_t filelength;
+    int32_t fd;                                         //   file descriptor of a mapped file, else -1
+    FILE *fin;                                          //   stdio handle, when the file cannot be mapped
+    void *mapbase;
+    size_t maplength;
+    uint8_t *buffer;
+    int64_t mtime;                                      //   modification time in nanoseconds, 0 if not a regular file
+    uint64_t inode;                                     //   inode number, 0 if not a regular file
+    uint64_t device;                                    //   device that holds it, 0 if not a regular file
+};
+
+#define OUTBUFSIZE      (256 * 1024)                    //   size of the disassembly output buffer
+#define OUTRESERVE      4096                            //   room kept free in the buffer for one more instruction
+
+// struct OUTBUF is an append-only buffer for the disassembly text, flushed with large write() calls
+
+struct OUTBUF {
+    uint8_t *buf;
+    size_t len;                                         //   count of bytes in the buffer
+    size_t size;
+    size_t flushlimit;                                  //   flush once the buffer holds more than this
+    int32_t fd;                                         //   file descriptor written by the default sink
+    int32_t (*sink)(void *sinkarg, const uint8_t *buf, size_t len);
+    void *sinkarg;                                      //   a sink returns 0, or -1 on error
+};
+
+// the operand forms in which an operation is rendered as text (see renderoperation() in tm32decode.c)
+
+enum OPFORM {
+    FORM_BINARY,                                        //   IF rG name rS1 rS2 -> rD
+    FORM_UNARY,                                         //   IF rG name rS1 -> rD
+    FORM_PARAM_UNARY,                                   //   IF rG name(P) rS1 -> rD
+    FORM_PARAM_BINARY_RESULTLESS,                       //   IF rG name(P) rS1 rS2
+    FORM_BINARY_RESULTLESS,                             //   IF rG name rS1 rS2
+    FORM_PARAM_UNARY_RESULTLESS,                        //   IF rG name(P) rS1
+    FORM_ZEROARY_RESULTLESS,                            //   IF rG name
+    FORM_ZEROARY,                                       //   IF rG name -> D
+    FORM_UNARY_RESULTLESS,                              //   IF rG name S1
+    FORM_PARAM32,                                       //   IF rG name(0xP) -> rD
+    FORM_PARAM32_RESULTLESS,                            //   IF rG name(0xP)
+    FORM_NOP,                                           //   IF r1   nop   (a compressed-out operation)
+    FORM_ILLEGAL,                                       //   an opcode that cannot be decoded in its size class
+    FORM_BADSIZE                                        //   an operation size that is not 0, 26, 34 or 42 bits
+};
+
+// the encodings of an operation, by compressed size and by the type bits 33 and 32
+
+enum OPCLASS {
+    OPCLASS_NOP,                                        //   0 bits
+    OPCLASS_26,                                         //   26 bits, 5-bit opcode
+    OPCLASS_34SHORT,                                    //   34 bits, 5-bit opcode (bit 33 clear)
+    OPCLASS_34LONG,                                     //   34 bits, 8-bit opcode (bit 33 set)
+    OPCLASS_42IMM,                                      //   42 bits, 32-bit immediate e.g. uimm (bit 33 set)
+    OPCLASS_42JUMP,                                     //   42 bits, 32-bit jump target e.g. jmpi (bits 33, 32 clear)
+    OPCLASS_42LONG                                      //   42 bits, 8-bit opcode
+};
+
+// struct TM32OP is one decoded operation. param is already sign extended and scaled by the
+// operation's paramfactor, or holds the 32-bit immediate of the param32 operations
+
+struct TM32OP {
+    uint16_t opindex;                                   //   index of the operation in oplist[]
+    uint8_t size;                                       //   compressed size in bits (0, 24, 32 or 40)
+    uint8_t sizeclass;                                  //   enum OPCLASS
+    uint8_t property;                                   //   enum OPPROP of the operation
+    uint8_t form;                                       //   enum OPFORM, the operands it is rendered with
+    uint8_t guard;
+    uint8_t src1;
+    uint8_t src2;
+    uint8_t dst;
+    int32_t param;
+};
+
+// struct TM32INSTR is one decoded instruction of five operations
+
+struct TM32INSTR {
+    uint64_t offset;                                    //   address of the instruction
+    uint64_t opbits[MAXSLOT];                           //   the unpacked operations, as 42-bit integers
+    uint16_t formatfield;                               //   the format field this instruction was decoded with
+    uint16_t nextformatfield;                           //   the format field it holds, for the next instruction
+    uint8_t length;                                     //   length in bytes
+    struct TM32OP op[MAXSLOT];
+};
+
+// trace categories, selected with -d/--debug. Trace output goes to the traceout of a TM32CTX.
+// Building with -DTM32_NOTRACE (make NOTRACE=1) compiles all tracing out.
+
+#define TRACE_UNPACK    0x01                            //   unpacking of operations from instructions
+#define TRACE_DECODE    0x02                            //   decoding of operation bit fields
+#define TRACE_MEMIMG    0x04                            //   transposed memory image dump
+#define TRACE_ALL       (TRACE_UNPACK | TRACE_DECODE | TRACE_MEMIMG)
+
+#if defined(TM32_NOTRACE)
+#define TRACING(ctx, category)  0
+#else
+#define TRACING(ctx, category)  ((ctx)->tracemask & (category))
+#endif
+
+// TRACE() checks the category before any of its arguments are evaluated, so when a category is
+// not being traced no formatting work is done at all
+#define TRACE(ctx, category, ...)   do { if(TRACING(ctx, category)) fprintf((ctx)->traceout, __VA_ARGS__); } while(0)
+
+// output formats, as -f. The text formats are for reading; the machine readable formats describe each
+// instruction as one record, with no other lines, so that they can be loaded without parsing text
+
+#define OUTFORMAT_TEXT      0                           //   -f0: an instruction over several lines, with its bits
+#define OUTFORMAT_LINE      1                           //   -f1: an instruction on each line
+#define OUTFORMAT_JSON      2                           //   -f json: a JSON object on each line (JSON Lines)
+#define OUTFORMAT_BIN       3                           //   -f bin: fixed size little endian records, as below
+#define MACHINEFORMAT(f)    ((f) == OUTFORMAT_JSON || (f) == OUTFORMAT_BIN)
+
+// -f bin writes a BINHEADERBYTES header, then a BINRECORDBYTES record for each instruction, all little endian:
+//
+//   header       0  magic "TM32BIN" and a zero byte
+//                8  uint16 version (BINVERSION)     10  uint16 record size      12  uint32 zero
+//   record       0  uint64 address                   8  uint16 format field it was decoded with, as -f0 prints them
+//               10  uint8 length in bytes           11  uint8 flags: 1 decision tree start, 2 illegal operation
+//               12  uint32 index in decision tree   16  five operations, then four zero bytes
+//   operation    0  uint16 opcode   2  uint8 form (enum OPFORM)   3  uint8 guard   4  uint8 src1
+//                5  uint8 src2      6  uint8 dst    7  uint8 compressed size in bits    8  int32 param
+
+#define BINVERSION      1
+#define BINHEADERBYTES  16
+#define BINRECORDBYTES  80
+#define BINOPBYTES      12
+#define BINFLAG_TREE    1
+#define BINFLAG_ILLEGAL 2
+
+// --profile times each stage of a disassembly, as wall time and, where the processor has a cycle
+// counter, cycles. The stages are timed a batch of instructions at a time, not one by one
+
+enum PROFILESTAGE {
+    PROFILE_LOAD,                                       //   opening the file and reading in the window
+    PROFILE_TRANSPOSE,                                  //   transposing a memory image
+    PROFILE_CHAIN,                                      //   following the format field chain to the instruction boundaries
+    PROFILE_UNPACK,                                     //   unpacking the operations from the instructions
+    PROFILE_DECODE,                                     //   decoding the operations
+    PROFILE_RENDER,                                     //   rendering and writing the text
+    PROFILE_STAGES
+};
+
+struct TM32PROFILE {
+    uint64_t ns[PROFILE_STAGES];
+    uint64_t cycles[PROFILE_STAGES];
+    uint64_t bytes;
+    uint64_t instructions;
+    uint64_t operations;                                //   operations that are not empty
+};
+
+struct PROFILEMARK {
+    uint64_t ns;
+    uint64_t cycles;
+};
+
+// struct TM32CTX holds the options, output sink and trace settings of one disassembly. The decoder
+// keeps no other mutable state, so any number of contexts can be used at once, from different
+// threads. The shared decode tables are built once by tm32init(), which tm32ctxinit() calls.
+
+struct TM32CTX {
+    uint32_t printoutformat;                            //   output format style, as -f
+    uint32_t threads;                                   //   count of threads tmdisassemble() may use
+    uint32_t tracemask;                                 //   the TRACE_ categories being traced
+    uint32_t resync;                                    //   skip data after an illegal operation, as --resync
+    struct TM32PROFILE *profile;                        //   where stage timings are added, as --profile, or NULL
+    FILE *traceout;                                     //   where trace output goes
+    struct OUTBUF out;                                  //   where the disassembly text goes
+};
+
+// struct TM32RANGE is one window of an object file to disassemble, as given by -s, -c and -a
+
+struct TM32RANGE {
+    uint64_t skip;
+    uint64_t count;                                     //   0 for the rest of the file
+    uint64_t offset;
+};
+
+// struct TM32SPAN describes a run of whole instructions in an object buffer, with the state of the
+// format field chain at its first instruction, so that it can be disassembled on its own
+
+struct TM32SPAN {
+    uint64_t start;                                     //   byte index of the first instruction
+    uint64_t end;                                       //   the span holds the instructions that start before this
+    uint64_t offset;                                    //   address of the first instruction
+    uint16_t formatfield;                               //   format field of the first instruction
+    uint32_t insnum;                                    //   index in its decision tree of the instruction before
+};
+
+#define MAXTHREADS      256                             //   most threads that --threads will start
+#define SPANMINBYTES    (64 * 1024)                     //   smallest span handed to a worker thread
+#define SPANMAXBYTES    (1024 * 1024)                   //   largest span wanted, where decision trees allow
+#define SPANSPERTHREAD  16                              //   spans to aim for per thread, to balance the load
+#define SPANSINFLIGHT   4                               //   spans per thread rendered ahead of the output
+
+uint8_t *putstr(uint8_t *p, const uint8_t *s);
+uint8_t *putreg(uint8_t *p, uint32_t r);
+uint8_t *putudec(uint8_t *p, uint32_t v);
+uint8_t *putdec(uint8_t *p, int32_t v);
+uint8_t *putudec64(uint8_t *p, uint64_t v);
+uint8_t *putle(uint8_t *p, uint64_t v, uint32_t bytes);
+uint64_t getle(const uint8_t *p, uint32_t bytes);
+uint8_t *puthex(uint8_t *p, uint64_t v, uint32_t mindigits);
+uint8_t *putpad(uint8_t *p, const uint8_t *start, uint32_t width);
+uint8_t *putopint(uint8_t *p, uint64_t opint64, uint8_t opsize);
+int32_t outinit(struct OUTBUF *out, int32_t fd, size_t size);
+void outflush(struct OUTBUF *out);
+uint8_t *outsync(struct OUTBUF *out, uint8_t *p);
+void outappend(struct OUTBUF *out, const uint8_t *buf, size_t len);
+void outfree(struct OUTBUF *out);
+
+int32_t openobjfile(const char *filename, struct OBJIMAGE *img);
+uint8_t *mapobjwindow(struct OBJIMAGE *img, uint64_t skipcount, uint64_t bytecount, uint32_t writable);
+uint32_t objfilechanged(const char *filename, const struct OBJIMAGE *img);
+void closeobjfile(struct OBJIMAGE *img);
+
+void initformatdescs(void);
 
 uint8_t operationsize(uint16_t formatbits, uint8_t slotnumber );
 uint16_t instructionlength(uint16_t formatbits);
-uint8_t *formatfieldstring(uint16_t formatbits);
-uint8_t *opintstr(uint64_t opint64, uint8_t opsize);
+uint8_t *putformatfield(uint8_t *p, uint16_t formatbits);
 uint8_t getrealopindex(uint16_t formatbits, uint8_t slotnumber);
 int32_t opcodebits2524tostring(uint8_t opcodebits2524, uint8_t *str);
 uint16_t operationoffset(uint16_t formatbits, uint8_t slotnumber);
 uint16_t extensionoffset(uint16_t formatbits, uint8_t slotnumber);
 const struct OPERATION *decodeop(uint32_t opcode);
+const struct OPERATION *decodeoplinear(uint32_t opcode);
+uint16_t opindex(const struct OPERATION *op);
+void initopcodetable(void);
+uint32_t checkopcodetable(void);
+int32_t selftest(void);
 int32_t signextend(uint8_t x);
-uint64_t unpackoperation(uint8_t *instruction, uint16_t formatbits, uint32_t slotnumber);
-uint64_t decodeoperation(uint32_t opsize, uint64_t opint64, uint8_t *opstring);
+uint64_t unpackoperation(struct TM32CTX *ctx, uint8_t *instruction, uint16_t formatbits, uint32_t slotnumber);
+void unpackinstruction(const uint8_t *instruction, uint16_t formatbits, uint64_t *opbits);
+uint32_t checkunpack(void);
+uint64_t decodeoperation(struct TM32CTX *ctx, uint32_t opsize, uint64_t opint64, struct TM32OP *dop);
+uint8_t *renderoperation(uint8_t *p, const struct TM32OP *dop);
+uint8_t *renderoperationjson(uint8_t *p, const struct TM32OP *dop);
+uint32_t checkdecodetable(void);
+void decodeinstruction(struct TM32CTX *ctx, uint8_t *instrptr, uint16_t formatfield, uint64_t offset, struct TM32INSTR *ins);
+uint32_t instructionclean(const struct TM32INSTR *ins);
+uint64_t decodeinstructions(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t bytecount, uint64_t offset, struct TM32INSTR *ins, uint64_t maxcount);
 void insbitreorder(uint8_t *instruction, uint16_t formatbits);
 void reversebits(uint8_t *ptr, uint16_t bitoffset, uint16_t bitcount);
-int extractmemimginstructions(uint8_t *objbuf, uint8_t *objbigendbuf, uint32_t dismcount);
+int extractmemimginstructions(struct TM32CTX *ctx, uint8_t *objbuf, uint8_t *objbigendbuf, uint64_t dismcount);
+int extractmemimginplace(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t dismcount);
+void extractmemimgbitwise(const uint8_t *objbuf, uint8_t *objbigendbuf, uint64_t dismcount);
+void transposememimgblock(const uint8_t *in, uint8_t *out, uint32_t count);
+void initmemimgkernel(void);
+uint32_t checkmemimgkernels(void);
 void reordermemimgbits(uint8_t *objbuf, uint64_t bytecount);
-void tmdisassemble(uint32_t printoutformat, uint8_t *objbuf, uint64_t bytecount, uint64_t offset);
+uint8_t *putbinheader(uint8_t *p);
+uint8_t *putdisassemblystart(const struct TM32CTX *ctx, uint8_t *p);
+uint8_t *putdisassemblyend(const struct TM32CTX *ctx, uint8_t *p);
+uint8_t *renderinstruction(uint8_t *p, uint32_t printoutformat, const struct TM32INSTR *ins, const uint8_t *instrptr, uint32_t insnum);
+void tm32init(void);
+int32_t tm32ctxinit(struct TM32CTX *ctx, int32_t fd, uint32_t printoutformat);
+void tm32ctxfree(struct TM32CTX *ctx);
+uint8_t *disassemblespan(struct TM32CTX *ctx, struct OUTBUF *out, uint8_t *p, uint8_t *objbuf, struct TM32SPAN *span);
+uint64_t splitspans(uint8_t *objbuf, uint64_t bytecount, uint64_t offset, uint64_t target, struct TM32SPAN *spans, uint64_t maxspans);
+uint32_t onlinecpus(void);
+uint8_t *renderordered(struct TM32CTX *ctx, uint8_t *p, uint8_t *(*render)(struct TM32CTX *ctx, struct OUTBUF *out, uint8_t *p, void *jobs, uint64_t index), void *jobs, uint64_t jobcount);
+uint8_t *disassemblethreaded(struct TM32CTX *ctx, uint8_t *p, uint8_t *objbuf, uint64_t bytecount, uint64_t offset);
+int32_t parserange(const char *str, struct TM32RANGE *range);
+int32_t addrange(struct TM32RANGE **ranges, uint32_t *count, const struct TM32RANGE *range);
+int32_t readrangesfile(const char *filename, struct TM32RANGE **ranges, uint32_t *count);
+int32_t tmdisassembleranges(struct TM32CTX *ctx, struct OBJIMAGE *img, const char *filename, uint32_t memoryimage, struct TM32RANGE *ranges, uint32_t count);
+int32_t tmdisassembletraverse(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t bytecount, uint64_t offset, const uint64_t *entries, uint32_t entrycount);
+int32_t tmdisassemblestream(struct TM32CTX *ctx, FILE *fin, const char *name, uint32_t memoryimage, uint64_t skip, uint64_t count, uint64_t offset);
+uint64_t resyncsearch(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t start, uint64_t end, uint64_t base);
+uint8_t *putskippeddata(struct OUTBUF *out, uint8_t *p, const uint8_t *data, uint64_t count, uint64_t offset);
+int32_t tmbuildindex(uint8_t *objbuf, uint64_t bytecount, const struct OBJIMAGE *img, uint64_t skip, uint32_t memoryimage, const char *indexname);
+int32_t tmdisassembleindexed(struct TM32CTX *ctx, struct OBJIMAGE *img, const char *filename, const char *indexname, uint32_t memoryimage, uint64_t skip, uint64_t count, uint64_t offset);
+int32_t tmdisassemblestriped(struct TM32CTX *ctx, struct OBJIMAGE *img, uint64_t base, uint64_t skip, uint64_t count, uint64_t offset);
+uint8_t *cachedmemimg(struct TM32CTX *ctx, const char *cachedir, struct OBJIMAGE *img, uint64_t skip, struct OBJIMAGE *cached);
+int32_t tmserve(struct TM32CTX *ctx, const char *socketname, uint32_t memoryimage, uint64_t offset, const char *cachedir);
+int32_t tmstatistics(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t bytecount, uint64_t offset, uint32_t json);
+void tmdisassemble(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t bytecount, uint64_t offset);
+int32_t tmscan(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t bytecount, uint64_t skip, uint64_t mininstructions);
+uint32_t checkscankernels(void);
+void profilemark(struct PROFILEMARK *mark);
+void profilestage(struct TM32PROFILE *prof, uint32_t stage, const struct PROFILEMARK *mark);
+void profiletouch(const uint8_t *buf, uint64_t count);
+uint8_t *disassembleprofiled(struct TM32CTX *ctx, struct OUTBUF *out, uint8_t *p, uint8_t *objbuf, struct TM32SPAN *span);
+void putprofile(const struct TM32PROFILE *prof, FILE *fout);
@@ -100,59 +100,38 @@ uint16_t instructionlength(uint16_t formatbits) {
     return len;
 }
 
-// formatfieldstring() is passed a two byte format field.
-// It returns a string of binary digits that represent the bit-encoded lengths
-// of each of the five operations for that instruction.
-
-uint8_t *formatfieldstring(uint16_t formatbits) {
+// putformatfield() is passed a two byte format field.
+// It writes a string of binary digits to p that represent the bit-encoded lengths
+// of each of the five operations for that instruction, and returns a pointer to its end.
+
+uint8_t *putformatfield(uint8_t *p, uint16_t formatbits) {
+    static const uint8_t slotbits[4][2] = { { '0', '0' },   // 26-bit
+                                            { '1', '0' },   // 34-bit
+                                            { '0', '1' },   // 42-bit
+                                            { '1', '1' } }; // 0-bit operation (NOP)
     uint32_t i;
-    static uint8_t formatstr[30];
-    uint8_t *str=formatstr;
 
     for(i=0;i<5;i++) {
-        switch(formatbits >> (2 * i) & 3) { 
-            case 0    : *str++ = '0';       // 26-bit
-                        *str++ = '0';
-                        break;
-            case 1    : *str++ = '1';       // 34-bit
-                        *str++ = '0';
-                        break;
-            case 2    : *str++ = '0';       // 42-bit
-                        *str++ = '1';
-                        break;
-            case 3    : *str++ = '1';       // 0-bit operation (NOP)
-                        *str++ = '1';
-                        break;
-            default   : return ("encoding error  (* -1 bits *)");
-            }
-        *str++ = ' ';
+        *p++ = slotbits[formatbits >> (2 * i) & 3][0];
+        *p++ = slotbits[formatbits >> (2 * i) & 3][1];
+        *p++ = ' ';
     }
-    *str++ = '\0';
-    return formatstr;
+    return p;
 }
 
-
-// opintstr() returns a hex string representing the opint64, formatted according to its bit length.
-uint8_t *opintstr(uint64_t opint64, uint8_t opsize) {
-    static uint8_t opint64str[24];
-
-    switch (opsize) {
-        case 0  : sprintf(opint64str, "\0");
-                  break;
-        case 24 : sprintf(opint64str, " %01x %02x %02x %02x", (uint8_t) (opint64>>24 & 0x03),
-                    (uint8_t)(opint64>>16 & 0xff), (uint8_t)(opint64>>8 & 0xff), (uint8_t)(opint64 & 0xff));
-                  break;
-        case 32 : sprintf(opint64str, " %01x %02x %02x %02x %02x",
-                    (uint8_t)(opint64>>32 & 0x03), (uint8_t)(opint64>>24 & 0xff), (uint8_t)(opint64>>16 & 0xff),
-                    (uint8_t)(opint64>>8 & 0xff), (uint8_t)(opint64 & 0xff));
-                  break;
-        case 40 : sprintf(opint64str, " %01x %02x %02x %02x %02x %02x",
-                    (uint8_t)(opint64>>40 & 0x03), (uint8_t)(opint64>>32 & 0xff), (uint8_t)(opint64>>24 & 0xff), 
-                    (uint8_t)(opint64>>16 & 0xff), (uint8_t)(opint64>>8 & 0xff), (uint8_t)(opint64 & 0xff));
-                  break;
-        default : sprintf(opint64str, "opintstr() error");
+// putopint() writes the hex bytes of opint64 to p, formatted according to its bit length, e.g. " 0 10 11 00"
+uint8_t *putopint(uint8_t *p, uint64_t opint64, uint8_t opsize) {
+    int32_t i;
+
+    if(opsize == 0)
+        return p;
+    *p++ = ' ';
+    p = puthex(p, (opint64 >> opsize) & 0x03, 1);           // the two spliced opcode bits, then the bytes
+    for(i=opsize-8;i>=0;i-=8) {
+        *p++ = ' ';
+        p = puthex(p, (opint64 >> i) & 0xff, 2);
     }
-    return opint64str;
+    return p;
 }
 
 // getrealopindex() returns the operation index for the operation in slot n.
@@ -243,9 +222,82 @@ uint16_t extensionoffset(uint16_t formatbits, uint8_t slotnumber) {
     return extoffset;
 }
 
-// decodeop() iterates the operations list for an opcode and returns the corresponding operation structure
+struct FORMATDESC formatdescs[FORMATDESCCOUNT];
+
+// initformatdescs() precomputes a FORMATDESC for each of the 1024 possible format fields, using the
+// per-slot helper functions above. The decode pipeline then finds the instruction length, operation
+// sizes and byte offsets with a single table lookup, instead of looping over the slots for each one.
+
+void initformatdescs(void) {
+    static uint32_t initialised = FALSE;
+    struct FORMATDESC *fd;
+    uint16_t formatbits;
+    uint8_t i;
+
+    if(initialised)
+        return;
+
+    for(formatbits=0;formatbits<FORMATDESCCOUNT;formatbits++) {
+        fd = &formatdescs[formatbits];
+        fd->inslength = instructionlength(formatbits);
+        fd->opcount = 0;
+        for(i=0;i<MAXSLOT;i++) {
+            fd->opsize[i] = operationsize(formatbits, i);
+            fd->insoffset[i] = 2 + operationoffset(formatbits, i) / 8;
+            fd->extoffset[i] = 2 + extensionoffset(formatbits, i) / 8;
+            fd->realopindex[i] = getrealopindex(formatbits, i);
+            fd->group2[i] = (fd->realopindex[i] > 2);
+            fd->fmtshift[i] = 6 - 2 * (fd->realopindex[i] - (fd->group2[i] ? 3 : 0));
+            if(fd->opsize[i] > 0)
+                fd->opcount++;
+        }
+    }
+    initialised = TRUE;
+}
+
+// opcodetable[] maps each 8-bit opcode directly onto its entry in oplist[]. The short 5-bit opcodes
+// of the 26 and 34-bit operations share their numbering with the first 32 long opcodes, so one table
+// of 256 entries covers both encodings. Opcodes that are missing from oplist[] point at the sentinel.
+
+#define OPCODETABLESIZE 256
+
+static const struct OPERATION *opcodetable[OPCODETABLESIZE];
+
+// initopcodetable() generates opcodetable[] from oplist[], so that the two can never disagree.
+// Where oplist[] holds duplicate opcodes, the first entry wins, as it does for decodeoplinear()
+
+void initopcodetable(void) {
+    static uint32_t initialised = FALSE;
+    uint32_t i;
+
+    if(initialised)
+        return;
+
+    for(i=0;i<OPCODETABLESIZE;i++)
+        opcodetable[i] = decodeoplinear(OPCODETABLESIZE);  // the null operation struct
+
+    for(i=0;oplist[i].opcode >= 0;i++)
+        if(oplist[i].opcode < OPCODETABLESIZE && opcodetable[oplist[i].opcode]->opcode < 0)
+            opcodetable[oplist[i].opcode] = &oplist[i];
+    initialised = TRUE;
+}
+
+// decodeop() returns the operation structure for an opcode with a single table lookup
 const struct OPERATION *decodeop(uint32_t opcode) {
 
+    if(opcode < OPCODETABLESIZE)
+        return opcodetable[opcode];
+    return decodeoplinear(opcode);      // opcode not found, so return a null operation struct
+}
+
+// opindex() returns the index in oplist[] of an operation structure returned by decodeop()
+uint16_t opindex(const struct OPERATION *op) {
+    return (uint16_t) (op - oplist);
+}
+
+// decodeoplinear() iterates the operations list for an opcode and returns the corresponding operation structure
+const struct OPERATION *decodeoplinear(uint32_t opcode) {
+
     uint32_t i=0;
     int32_t code=0;
 
@@ -257,6 +309,26 @@ const struct OPERATION *decodeop(uint32_t opcode) {
     return &oplist[i];      // opcode not found, so return a null operation struct
 }
 
+// checkopcodetable() verifies that every opcode, and every entry in oplist[], resolves to the
+// same operation structure through opcodetable[] as through the linear scan of oplist[].
+// returns the count of mismatches
+
+uint32_t checkopcodetable(void) {
+    uint32_t i, errors = 0;
+
+    for(i=0;i<OPCODETABLESIZE+1;i++)
+        if(decodeop(i) != decodeoplinear(i)) {
+            fprintf(stderr, "opcode %d: table gives '%s', oplist gives '%s'\n", i, decodeop(i)->opname, decodeoplinear(i)->opname);
+            errors++;
+        }
+    for(i=0;oplist[i].opcode >= 0;i++)
+        if(decodeop(oplist[i].opcode) != decodeoplinear(oplist[i].opcode)) {
+            fprintf(stderr, "oplist[%d] '%s': table and oplist disagree\n", i, oplist[i].opname);
+            errors++;
+        }
+    return errors;
+}
+
 // sign extending from a constant 7-bit width
 // taken from Sean Eron Anderson's Bit Twiddling Hacks.
 int32_t signextend(uint8_t x) {
@@ -0,0 +1,466 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com>
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <getopt.h>
+#if defined(__MINGW32__)
+#include <fcntl.h>
+#include <io.h>
+#endif
+#include "tm32dis.h"
+#include "tm32disinstrs.h"
+
+
+// tm32gen writes a synthetic TM3260 instruction stream, for benchmarking the disassembler. Every
+// instruction decodes cleanly: the format field chain is followed as the disassembler follows it,
+// decision trees start with an uncompressed instruction, and every operation is a legal one.
+//
+// Legal operations are found by decoding random bits with the disassembler's own decoder, and a few
+// examples of each operation are kept in a pool for each of the three operation sizes. The format of
+// each instruction is drawn from a list of format fields, or slot by slot from weights for the empty,
+// 26, 34 and 42 bit sizes, and each operation from a list of weighted names, or from all of them.
+
+#define OPLISTSIZE      (sizeof(oplist) / sizeof(oplist[0]))
+#define SIZECLASSES     4                               //   empty, 26, 34 and 42 bit operations
+#define POOLSAMPLES     (1 << 18)                       //   random operations decoded for each size
+#define POOLPEROP       16                              //   examples kept of each operation in each size
+#define GENCHUNK        (1024 * 1024)                   //   bytes written at a time, a multiple of the 32 byte block
+#define TREEFORMAT      0x2aa                           //   format descriptor index of the format bytes 0xaa 0x02
+
+static const uint8_t sizebits[SIZECLASSES] = { 0, 24, 32, 40 };
+
+// struct OPPOOL holds the examples of each operation, as unpacked operation bits, for one size
+
+struct OPPOOL {
+    uint64_t ops[OPLISTSIZE][POOLPEROP];
+    uint32_t count[OPLISTSIZE];
+    uint64_t cumweight[OPLISTSIZE];                     //   running total of the weights of the operations, to pick from
+};
+
+struct GENSPEC {
+    uint32_t sizeweight[SIZECLASSES];
+    uint16_t *formats;                                  //   format descriptor indexes to choose from, or NULL
+    uint32_t formatcount;
+    uint32_t opweight[OPLISTSIZE];                      //   all zero for every operation alike
+    uint32_t treelength;                                //   mean count of instructions in a decision tree
+    uint32_t memoryimage;
+};
+
+static struct OPPOOL pools[SIZECLASSES];
+static uint16_t sizeformat[SIZECLASSES * SIZECLASSES * SIZECLASSES * SIZECLASSES * SIZECLASSES];
+static uint64_t rngstate;
+
+static char usage_msg[] =
+    "USAGE: tm32gen -c <bytes> [options]\n" \
+    " -c, --count <n>         Write <n> bytes (a K, M or G suffix multiplies by 1024s)\n" \
+    " -o, --output <file>     Write to <file> (default standard output)\n" \
+    " -m, --memimg            Bit-stripe the stream as a memory image, for tm32dis -m\n" \
+    "     --sizes <e,26,34,42> Weights of empty, 26, 34 and 42 bit operations (default 2,4,3,1)\n" \
+    "     --formats <f,..>    Use only these format fields, as -f0 prints them, e.g. 0xaa02\n" \
+    "     --ops <name[:w],..> Use only these operations, with weights <w> (default all alike)\n" \
+    "     --tree <n>          Mean count of instructions in a decision tree (default 8)\n" \
+    "     --seed <n>          Seed of the random numbers (default 1)\n\n";
+
+// nextrandom() returns the next number from a xorshift64* generator, so that the same seed gives
+// the same stream on every platform
+static uint64_t nextrandom(void) {
+    rngstate ^= rngstate >> 12;
+    rngstate ^= rngstate << 25;
+    rngstate ^= rngstate >> 27;
+    return rngstate * 0x2545f4914f6cdd1dULL;
+}
+
+// pickweighted() returns an index into the count weights, at random in proportion to them, or
+// count if they are all zero
+static uint32_t pickweighted(const uint32_t *weights, uint32_t count) {
+    uint64_t total = 0, r;
+    uint32_t i;
+
+    for(i=0;i<count;i++)
+        total += weights[i];
+    if(!total)
+        return count;
+    r = nextrandom() % total;
+    for(i=0;i<count;i++) {
+        if(r < weights[i])
+            return i;
+        r -= weights[i];
+    }
+    return count;
+}
+
+// buildpools() decodes random operations of each size, and keeps the legal ones in pools[]
+static void buildpools(void) {
+    struct TM32CTX ctx;
+    struct TM32OP op;
+    struct OPPOOL *pool;
+    uint64_t opbits;
+    uint32_t size, n;
+
+    memset(&ctx, 0, sizeof(ctx));                                   // no tracing
+    for(size=1;size<SIZECLASSES;size++) {
+        pool = &pools[size];
+        for(n=0;n<POOLSAMPLES;n++) {
+            opbits = nextrandom() & ((1ULL << (sizebits[size] + 2)) - 1);
+            decodeoperation(&ctx, sizebits[size], opbits, &op);
+            if(op.form == FORM_ILLEGAL || op.form == FORM_BADSIZE || op.form == FORM_NOP)
+                continue;
+            if(pool->count[op.opindex] < POOLPEROP)
+                pool->ops[op.opindex][pool->count[op.opindex]++] = opbits;
+        }
+    }
+}
+
+// buildsizeformats() fills sizeformat[] with the format descriptor index for each combination of
+// operation sizes in the five slots
+static void buildsizeformats(void) {
+    const struct FORMATDESC *fd;
+    uint32_t f, i, key, size;
+
+    for(f=0;f<FORMATDESCCOUNT;f++) {
+        fd = &formatdescs[f];
+        for(i=0, key=0;i<MAXSLOT;i++) {
+            for(size=0;size<SIZECLASSES && sizebits[size]!=fd->opsize[i];size++)
+                ;
+            key = key * SIZECLASSES + size;
+        }
+        sizeformat[key] = f;
+    }
+}
+
+// buildopweights() sets the weights of the operations in each pool from spec: the weighted operations
+// that there are of that size, or all of them alike if none of the weighted ones are
+static void buildopweights(const struct GENSPEC *spec) {
+    struct OPPOOL *pool;
+    uint64_t total;
+    uint32_t size, i;
+
+    for(size=1;size<SIZECLASSES;size++) {
+        pool = &pools[size];
+        for(i=0, total=0;i<OPLISTSIZE;i++)
+            pool->cumweight[i] = total += pool->count[i] ? spec->opweight[i] : 0;
+        if(!total)
+            for(i=0;i<OPLISTSIZE;i++)
+                pool->cumweight[i] = total += (pool->count[i] != 0);
+    }
+}
+
+// pickop() returns the bits of an operation of size class size, at random by the weights of its pool
+static uint64_t pickop(uint32_t size) {
+    const struct OPPOOL *pool = &pools[size];
+    uint64_t r = nextrandom() % pool->cumweight[OPLISTSIZE - 1];
+    uint32_t low = 0, high = OPLISTSIZE - 1, mid;
+
+    while(low < high) {                                             // the first operation whose running total is past r
+        mid = (low + high) / 2;
+        if(pool->cumweight[mid] > r)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    return pool->ops[low][nextrandom() % pool->count[low]];
+}
+
+// packinstruction() writes an instruction of format descriptor index format, holding the operations
+// opbits, to instruction, with nextformat as the format field for the instruction after it. This is
+// unpackinstruction() in reverse. returns the length of the instruction in bytes
+static uint32_t packinstruction(uint8_t *instruction, uint32_t format, uint32_t nextformat, const uint64_t *opbits) {
+    const struct FORMATDESC *fd = &formatdescs[format];
+    uint32_t i, length = fd->inslength / 8;
+    uint8_t *op, *ext;
+
+    memset(instruction, 0, length);
+    instruction[0] = nextformat & 0xff;
+    instruction[1] = nextformat >> 8;
+    for(i=0;i<MAXSLOT;i++) {
+        if(!fd->opsize[i])
+            continue;
+        op = instruction + fd->insoffset[i];
+        ext = instruction + fd->extoffset[i];
+        op[0] = opbits[i];
+        op[1] = opbits[i] >> 8;
+        op[2] = opbits[i] >> 16;
+        instruction[fd->group2[i] ? 11 : 1] |= ((opbits[i] >> 24) & 3) << (fd->fmtshift[i] & 7);
+        if(fd->opsize[i] >= 32)
+            ext[0] = opbits[i] >> 26;
+        if(fd->opsize[i] == 40)
+            ext[1] = opbits[i] >> 34;
+    }
+    return length;
+}
+
+// pickformat() returns the format descriptor index of the next instruction, which starts a new
+// decision tree if tree
+static uint32_t pickformat(const struct GENSPEC *spec, uint32_t tree) {
+    uint32_t i, key, size;
+
+    if(tree)
+        return TREEFORMAT;
+    if(spec->formats)
+        return spec->formats[nextrandom() % spec->formatcount];
+    for(i=0, key=0;i<MAXSLOT;i++) {
+        size = pickweighted(spec->sizeweight, SIZECLASSES);
+        key = key * SIZECLASSES + (size == SIZECLASSES ? 0 : size);
+    }
+    return sizeformat[key];
+}
+
+// stripeblocks() bit-stripes blockcount blocks from in to out, as they are in a memory image. This is
+// the transposition of extractmemimgbitwise() in reverse: bit m of byte (j*4 + k) of in becomes
+// bit j of byte (k*8 + m) of out. Each 8x8 bit matrix is transposed in a 64-bit word, as the
+// transposeblocksword() kernel does
+static void stripeblocks(const uint8_t *in, uint8_t *out, uint64_t blockcount) {
+    uint64_t x, t;
+    uint32_t j, k;
+
+    while(blockcount--) {
+        for(k=0;k<4;k++) {
+            for(j=0, x=0;j<8;j++)
+                x |= (uint64_t) in[j * 4 + k] << (8 * j);
+            t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+            x ^= t ^ (t << 7);
+            t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+            x ^= t ^ (t << 14);
+            t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+            x ^= t ^ (t << 28);
+            for(j=0;j<8;j++)
+                out[k * 8 + j] = x >> (8 * j);
+        }
+        in += 32;
+        out += 32;
+    }
+}
+
+// generate() writes count bytes of instruction stream, as spec asks, to fout.
+// returns 0 on success, -1 on error (which is reported)
+static int32_t generate(const struct GENSPEC *spec, uint64_t count, FILE *fout) {
+    uint8_t *buf, *striped = NULL;
+    uint64_t opbits[MAXSLOT], written = 0, want;
+    uint32_t format = TREEFORMAT, nextformat, len = 0, i;
+    const struct FORMATDESC *fd;
+
+    buf = (uint8_t *) malloc(GENCHUNK + MAXTM32INSLEN / 8 + 32);
+    if(spec->memoryimage)
+        striped = (uint8_t *) malloc(GENCHUNK + 32);
+    if(!buf || (spec->memoryimage && !striped)) {
+        fprintf(stderr, "Could not malloc %d bytes generator buffer\n", GENCHUNK);
+        free(buf);
+        return -1;
+    }
+
+    while(written < count) {
+        while(len < GENCHUNK) {
+            fd = &formatdescs[format];
+            for(i=0;i<MAXSLOT;i++)
+                opbits[i] = fd->opsize[i] ? pickop(fd->opsize[i] / 8 - 2) : 0;
+            nextformat = pickformat(spec, spec->treelength && nextrandom() % spec->treelength == 0);
+            len += packinstruction(buf + len, format, nextformat, opbits);
+            format = nextformat;
+        }
+        want = (count - written < GENCHUNK) ? count - written : GENCHUNK;
+        if(spec->memoryimage)                                       // a partial block at the end is striped whole
+            stripeblocks(buf, striped, (want + 31) / 32);
+        if(fwrite(spec->memoryimage ? striped : buf, 1, want, fout) != want) {
+            fprintf(stderr, "Could not write the generated stream\n");
+            free(buf);
+            free(striped);
+            return -1;
+        }
+        written += want;
+        memmove(buf, buf + GENCHUNK, len - GENCHUNK);               // carry over the instruction that runs past the chunk
+        len -= GENCHUNK;
+    }
+    free(buf);
+    free(striped);
+    return 0;
+}
+
+// parsecount() reads a count of bytes with an optional K, M or G suffix. returns 0 if it is bad
+static uint64_t parsecount(const char *s) {
+    char *end;
+    uint64_t n = strtoull(s, &end, 0);
+
+    switch(*end) {
+        case 'k': case 'K': n <<= 10; end++; break;
+        case 'm': case 'M': n <<= 20; end++; break;
+        case 'g': case 'G': n <<= 30; end++; break;
+    }
+    return *end ? 0 : n;
+}
+
+// parsesizes() reads the four comma separated weights of the operation sizes. returns -1 if bad
+static int32_t parsesizes(const char *s, struct GENSPEC *spec) {
+    char *end;
+    uint32_t i;
+
+    for(i=0;i<SIZECLASSES;i++) {
+        spec->sizeweight[i] = strtoul(s, &end, 0);
+        if(end == s || *end != (i == SIZECLASSES - 1 ? '\0' : ','))
+            return -1;
+        s = end + 1;
+    }
+    return 0;
+}
+
+// parseformats() reads a comma separated list of format fields, written as -f0 prints them.
+// returns -1 if bad
+static int32_t parseformats(const char *s, struct GENSPEC *spec) {
+    char *end;
+    uint32_t v;
+
+    for(spec->formatcount=1, end=(char *) s;*end;end++)
+        spec->formatcount += (*end == ',');
+    if(!(spec->formats = (uint16_t *) malloc(spec->formatcount * sizeof(uint16_t))))
+        return -1;
+    for(spec->formatcount=0;;s=end+1) {
+        v = strtoul(s, &end, 0);
+        if(end == s)
+            return -1;
+        spec->formats[spec->formatcount++] = (v >> 8) | ((v & 3) << 8);
+        if(*end != ',')
+            return *end ? -1 : 0;
+    }
+}
+
+// parseops() reads a comma separated list of operation names, each with an optional :weight.
+// returns -1 if a name is not in oplist[]
+static int32_t parseops(const char *s, struct GENSPEC *spec) {
+    uint32_t i, len, weight, found;
+    char *end;
+
+    while(*s) {
+        len = strcspn(s, ":,");
+        weight = 1;
+        end = (char *) s + len;
+        if(*end == ':')
+            weight = strtoul(end + 1, &end, 0);
+        for(i=0, found=FALSE;i<OPLISTSIZE;i++)
+            if(strlen((const char *) oplist[i].opname) == len && !strncmp((const char *) oplist[i].opname, s, len)) {
+                spec->opweight[i] = weight;
+                found = TRUE;
+            }
+        if(!found || (*end && *end != ','))
+            return -1;
+        s = end + (*end == ',');
+    }
+    return 0;
+}
+
+static struct option longopts[] = {
+    {"count",   required_argument, 0, 'c'},
+    {"output",  required_argument, 0, 'o'},
+    {"memimg",  no_argument, 0, 'm'},
+    {"sizes",   required_argument, 0, 'z'},
+    {"formats", required_argument, 0, 'F'},
+    {"ops",     required_argument, 0, 'O'},
+    {"tree",    required_argument, 0, 'e'},
+    {"seed",    required_argument, 0, 'r'},
+    {"help",    no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+};
+
+// main()
+//
+int main(int argc, char **argv) {
+
+    struct GENSPEC spec;
+    uint64_t count = 0, seed = 1;
+    char *outname = NULL;
+    FILE *fout = stdout;
+    int32_t ret;
+
+    memset(&spec, 0, sizeof(spec));
+    spec.sizeweight[0] = 2;
+    spec.sizeweight[1] = 4;
+    spec.sizeweight[2] = 3;
+    spec.sizeweight[3] = 1;
+    spec.treelength = 8;
+
+    while (TRUE) {
+        int32_t optidx = 0;
+        int c = getopt_long(argc, argv, "c:o:mh", longopts, &optidx);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 'c': if(!(count = parsecount(optarg))) {
+                          fprintf(stderr, "Bad count '%s'\n", optarg);
+                          return -1;
+                      }
+                      break;
+            case 'o': outname = optarg;
+                      break;
+            case 'm': spec.memoryimage = TRUE;
+                      break;
+            case 'z': if(parsesizes(optarg, &spec) < 0) {
+                          fprintf(stderr, "Bad size weights '%s', expected four numbers e,26,34,42\n", optarg);
+                          return -1;
+                      }
+                      break;
+            case 'F': if(parseformats(optarg, &spec) < 0) {
+                          fprintf(stderr, "Bad format list '%s'\n", optarg);
+                          return -1;
+                      }
+                      break;
+            case 'O': if(parseops(optarg, &spec) < 0) {
+                          fprintf(stderr, "Bad operation list '%s'\n", optarg);
+                          return -1;
+                      }
+                      break;
+            case 'e': spec.treelength = strtoul(optarg, NULL, 0);
+                      break;
+            case 'r': seed = strtoull(optarg, NULL, 0);
+                      break;
+            case 'h': fprintf(stdout, "%s", usage_msg);
+                      return 0;
+            default : fprintf(stderr, "%s", usage_msg);
+                      return -1;
+        }
+    }
+    if(!count) {
+        fprintf(stderr, "%s", usage_msg);
+        return -1;
+    }
+
+    tm32init();
+    rngstate = seed ? seed : 1;                                     // xorshift never leaves zero
+    buildpools();
+    buildopweights(&spec);
+    buildsizeformats();
+
+    if(outname && !(fout = fopen(outname, "wb"))) {
+        fprintf(stderr, "Could not create '%s'\n", outname);
+        return -1;
+    }
+#if defined(__MINGW32__)
+    if(!outname)
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    ret = generate(&spec, count, fout);
+    if(outname && fclose(fout) != 0) {
+        fprintf(stderr, "Could not write '%s'\n", outname);
+        ret = -1;
+    }
+    free(spec.formats);
+    return ret;
+}
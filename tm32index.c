@@ -0,0 +1,271 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com>
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#if defined(__MINGW32__)
+#include "windows/byteswap.h"
+#else
+#include <byteswap.h>
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "tm32dis.h"
+
+
+// An instruction can only be decoded with the format field held in the instruction before it, so
+// disassembling a window in the middle of an image means following the chain from the start. An
+// index file records the state of the chain at every decision tree, and at least every INDEXINTERVAL
+// bytes between them, as a sorted array. A window is then disassembled by a binary search for the
+// last checkpoint before it, and a short walk of the chain from there.
+//
+// The file holds a header and then the checkpoints, all little endian:
+//
+//   header      magic "TM32IDX" and a zero byte, version, memory image flag, file length, file
+//               modification time in nanoseconds, file inode, skip (where the chain starts in the
+//               file), bytecount, count of checkpoints
+//
+// The length, modification time and inode of the object file are checked before an index is used,
+// so an index is refused once the file it was built for has been rewritten, in place or by rename.
+//   checkpoint  byte index in the instruction stream, format field (its two bytes as they are in the
+//               stream), tree flag, insnum (see struct TM32SPAN)
+
+#define INDEXMAGIC          "TM32IDX"
+#define INDEXVERSION        3
+#define INDEXINTERVAL       4096                        //   most bytes between checkpoints
+#define INDEXHEADERBYTES    64
+#define INDEXENTRYBYTES     16
+
+struct INDEXENTRY {
+    uint64_t pos;                                       //   byte index in the instruction stream
+    uint16_t formatfield;                               //   format field of the instruction there
+    uint16_t tree;                                      //   TRUE if it starts a decision tree
+    uint32_t insnum;                                    //   index in its decision tree of the instruction before
+};
+
+struct TM32INDEX {
+    uint32_t memoryimage;
+    uint64_t filelength;
+    int64_t mtime;
+    uint64_t inode;
+    uint64_t skip;
+    uint64_t bytecount;
+    uint64_t count;
+    struct OBJIMAGE file;                               //   the index file, mapped
+    const uint8_t *entries;                             //   its checkpoints, as they are in the file
+};
+
+// tmbuildindex() follows the format field chain through the bytecount bytes of instruction stream
+// at objbuf, which start at byte skip of the object file img, and writes its checkpoints to indexname.
+// returns 0 on success, -1 on error (which is reported)
+
+int32_t tmbuildindex(uint8_t *objbuf, uint64_t bytecount, const struct OBJIMAGE *img, uint64_t skip, uint32_t memoryimage, const char *indexname) {
+
+    uint16_t formatfield = bswap_16(BRTARGETFORMATBYTES);
+    uint64_t pos = 0, last = 0, count = 0;
+    uint32_t insnum = 0, length;
+    uint8_t record[INDEXHEADERBYTES];
+    FILE *fout;
+
+    if(!(fout = fopen(indexname, "wb"))) {
+        fprintf(stderr, "Could not create index file '%s'\n", indexname);
+        return -1;
+    }
+    memset(record, 0, INDEXHEADERBYTES);                            // the count is filled in at the end
+    fwrite(record, 1, INDEXHEADERBYTES, fout);
+
+    while(pos < bytecount) {
+        length = GETFORMATDESC(formatfield)->inslength / 8;
+        if(pos == 0 || length * 8 == MAXTM32INSLEN || pos - last >= INDEXINTERVAL) {
+            putle(record, pos, 8);
+            memcpy(record + 8, &formatfield, 2);
+            putle(record + 10, length * 8 == MAXTM32INSLEN, 2);
+            putle(record + 12, insnum, 4);
+            fwrite(record, 1, INDEXENTRYBYTES, fout);
+            last = pos;
+            count++;
+        }
+        insnum = (length * 8 == MAXTM32INSLEN) ? 0 : insnum + 1;
+        memcpy(&formatfield, objbuf + pos, 2);                      // format field for the next instruction
+        pos += length;
+    }
+
+    memcpy(record, INDEXMAGIC, 8);
+    putle(record + 8, INDEXVERSION, 4);
+    putle(record + 12, memoryimage, 4);
+    putle(record + 16, img->filelength, 8);
+    putle(record + 24, img->mtime, 8);
+    putle(record + 32, img->inode, 8);
+    putle(record + 40, skip, 8);
+    putle(record + 48, bytecount, 8);
+    putle(record + 56, count, 8);
+    if(fseek(fout, 0L, SEEK_SET) != 0 || fwrite(record, 1, INDEXHEADERBYTES, fout) != INDEXHEADERBYTES || ferror(fout)) {
+        fprintf(stderr, "Could not write index file '%s'\n", indexname);
+        fclose(fout);
+        return -1;
+    }
+    if(fclose(fout) != 0) {
+        fprintf(stderr, "Could not write index file '%s'\n", indexname);
+        return -1;
+    }
+    fprintf(stdout, "Wrote %" PRId64 " checkpoints for %" PRId64 " (0x%" PRIx64 ") bytes to index file '%s'\n", count, bytecount, bytecount, indexname);
+    return 0;
+}
+
+// readindex() maps the index file indexname into idx, and checks its header. The checkpoints are
+// left in the file, to be decoded by getcheckpoint() as the search reaches them, so a query only
+// faults in the pages it visits. returns 0 on success, -1 on error (which is reported)
+static int32_t readindex(const char *indexname, struct TM32INDEX *idx) {
+    const uint8_t *header;
+
+    if(openobjfile(indexname, &idx->file) < 0) {
+        fprintf(stderr, "Could not open index file '%s'\n", indexname);
+        return -1;
+    }
+    if(idx->file.filelength < INDEXHEADERBYTES || !(header = mapobjwindow(&idx->file, 0, idx->file.filelength, FALSE)) ||
+       memcmp(header, INDEXMAGIC, 8) || getle(header + 8, 4) != INDEXVERSION) {
+        fprintf(stderr, "'%s' is not a tm32dis index file\n", indexname);
+        return -1;
+    }
+    idx->memoryimage = getle(header + 12, 4);
+    idx->filelength = getle(header + 16, 8);
+    idx->mtime = getle(header + 24, 8);
+    idx->inode = getle(header + 32, 8);
+    idx->skip = getle(header + 40, 8);
+    idx->bytecount = getle(header + 48, 8);
+    idx->count = getle(header + 56, 8);
+    if(!idx->count || idx->count > (idx->file.filelength - INDEXHEADERBYTES) / INDEXENTRYBYTES ||
+       idx->file.filelength != INDEXHEADERBYTES + idx->count * INDEXENTRYBYTES) {
+        fprintf(stderr, "Index file '%s' is truncated\n", indexname);
+        return -1;
+    }
+    idx->entries = header + INDEXHEADERBYTES;
+    return 0;
+}
+
+// getcheckpoint() decodes checkpoint i of idx into cp
+static void getcheckpoint(const struct TM32INDEX *idx, uint64_t i, struct INDEXENTRY *cp) {
+    const uint8_t *record = idx->entries + i * INDEXENTRYBYTES;
+
+    cp->pos = getle(record, 8);
+    memcpy(&cp->formatfield, record + 8, 2);
+    cp->tree = getle(record + 10, 2);
+    cp->insnum = getle(record + 12, 4);
+}
+
+// findcheckpoint() decodes into cp the last checkpoint of idx at or before byte pos of the instruction stream
+static void findcheckpoint(const struct TM32INDEX *idx, uint64_t pos, struct INDEXENTRY *cp) {
+    uint64_t low = 0, high = idx->count, mid;
+
+    while(high - low > 1) {                                         // checkpoint low is at or before pos always
+        mid = low + (high - low) / 2;
+        if(getle(idx->entries + mid * INDEXENTRYBYTES, 8) <= pos)
+            low = mid;
+        else
+            high = mid;
+    }
+    getcheckpoint(idx, low, cp);
+}
+
+// tmdisassembleindexed() disassembles count bytes (0 for the rest) from byte skip of the object file
+// img, named filename, at address offset, decoding with the format field chain recorded in the index
+// file indexname. The disassembly starts at the first instruction at or after skip.
+// returns 0 on success, -1 on error (which is reported)
+
+int32_t tmdisassembleindexed(struct TM32CTX *ctx, struct OBJIMAGE *img, const char *filename, const char *indexname, uint32_t memoryimage, uint64_t skip, uint64_t count, uint64_t offset) {
+
+    struct TM32INDEX idx;
+    struct OUTBUF *out = &ctx->out;
+    struct INDEXENTRY checkpoint, *cp = &checkpoint;
+    struct TM32SPAN span;
+    uint8_t *objbuf;
+    uint64_t start, end, base, pos;
+    uint16_t formatfield;
+    uint32_t insnum, length;
+    int32_t ret = -1;
+    uint8_t *p;
+
+    memset(&idx, 0, sizeof(idx));
+    idx.file.fd = -1;
+    if(readindex(indexname, &idx) < 0)
+        goto done;
+    if(idx.memoryimage != memoryimage) {
+        fprintf(stderr, "Index file '%s' was not built for '%s'%s\n", indexname, filename, memoryimage ? " as a memory image" : "");
+        goto done;
+    }
+    if(idx.filelength != img->filelength || idx.mtime != img->mtime || idx.inode != img->inode) {
+        fprintf(stderr, "Index file '%s' is stale: '%s' has changed since it was built\n", indexname, filename);
+        goto done;
+    }
+    if(skip < idx.skip || skip - idx.skip > idx.bytecount || count > idx.bytecount - (skip - idx.skip)) {
+        fprintf(stderr, "Window is outside the bytes covered by index file '%s'\n", indexname);
+        goto done;
+    }
+
+    start = skip - idx.skip;                                        // the window, in bytes of the instruction stream
+    end = count ? start + count : idx.bytecount;
+    findcheckpoint(&idx, start, cp);
+    base = memoryimage ? cp->pos / 32 * 32 : cp->pos;               // a memory image is transposed in whole blocks
+
+    if(!(objbuf = mapobjwindow(img, idx.skip + base, end - base, memoryimage))) {
+        fprintf(stderr, "Could not read from tm32 object file '%s'\n", filename);
+        goto done;
+    }
+    fprintf(stdout, "Read in %" PRId64 " (0x%" PRIx64 ") bytes from file '%s'\n", img->filelength, img->filelength, filename);
+    fprintf(stdout, "Using index file '%s'\n", indexname);
+    if(skip)
+        fprintf(stdout, "Skipping %" PRId64 " (0x%" PRIx64 ") bytes\n", skip, skip);
+    if(offset)
+        fprintf(stdout, "Using 0x%" PRIx64 " adjustment offset\n", offset);
+    fprintf(stdout, "Disassembling %" PRId64 " (0x%" PRIx64 ") bytes\n", end - start, end - start);
+    if(memoryimage) {
+        fprintf(stdout, "Transposing memory image from bit-striped to sequential bytes\n");
+        extractmemimginplace(ctx, objbuf, MEMIMGBYTES(end - base));
+    }
+
+    pos = cp->pos;                                                  // walk the chain from the checkpoint
+    formatfield = cp->formatfield;                                  // to the first instruction in the window
+    insnum = cp->insnum;
+    while(pos < start) {
+        length = GETFORMATDESC(formatfield)->inslength / 8;
+        insnum = (length * 8 == MAXTM32INSLEN) ? 0 : insnum + 1;
+        memcpy(&formatfield, objbuf + pos - base, 2);
+        pos += length;
+    }
+
+    span.start = pos - base;
+    span.end = end - base;
+    span.offset = offset + (pos - start);
+    span.formatfield = formatfield;
+    span.insnum = insnum;
+
+    if(TRACING(ctx, TRACE_ALL))                                     // trace output may share the stream through stdio, so
+        out->flushlimit = 0;                                        // flush after every instruction to keep the two in order
+    p = putdisassemblystart(ctx, out->buf + out->len);
+    p = disassemblespan(ctx, out, p, objbuf, &span);
+    p = putdisassemblyend(ctx, p);
+    out->len = p - out->buf;
+    outflush(out);
+    ret = 0;
+
+done:
+    closeobjfile(&idx.file);
+    return ret;
+}
@@ -0,0 +1,161 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com> 
+//     
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined(__MINGW32__)
+#define _DEFAULT_SOURCE                             // for MAP_ANONYMOUS and madvise() under -std=c99
+#define _BSD_SOURCE
+#define TM32_HAVE_MMAP
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(TM32_HAVE_MMAP)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "tm32dis.h"
+
+#if defined(__APPLE__)
+#define STATMTIMENS(st)     ((int64_t) (st).st_mtimespec.tv_sec * 1000000000 + (st).st_mtimespec.tv_nsec)
+#elif defined(TM32_HAVE_MMAP)
+#define STATMTIMENS(st)     ((int64_t) (st).st_mtim.tv_sec * 1000000000 + (st).st_mtim.tv_nsec)
+#else
+#define STATMTIMENS(st)     ((int64_t) (st).st_mtime * 1000000000)
+#endif
+
+
+// openobjfile() opens a TM3260 object file and finds its length, modification time, inode and device,
+// without reading any of it. returns 0 on success, -1 if the file could not be opened
+
+int32_t openobjfile(const char *filename, struct OBJIMAGE *img) {
+    struct stat st;
+
+    memset(img, 0, sizeof(struct OBJIMAGE));
+    img->fd = -1;
+#if defined(TM32_HAVE_MMAP)
+    if((img->fd = open(filename, O_RDONLY)) < 0)
+        return -1;
+    if(fstat(img->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        img->filelength = st.st_size;
+        img->mtime = STATMTIMENS(st);
+        img->inode = st.st_ino;
+        img->device = st.st_dev;
+        return 0;
+    }
+    close(img->fd);                                 // not a regular file, so use the stdio path below
+    img->fd = -1;
+#endif
+    if(!(img->fin = fopen(filename, "rb")))
+        return -1;
+    if(stat(filename, &st) == 0 && S_ISREG(st.st_mode)) {
+        img->mtime = STATMTIMENS(st);
+        img->inode = st.st_ino;
+        img->device = st.st_dev;
+    }
+    fseek(img->fin, 0L, SEEK_END);                  // find object file length
+    img->filelength = ftell(img->fin);
+    fseek(img->fin, 0L, SEEK_SET);
+    return 0;
+}
+
+// objfilechanged() returns TRUE if the file filename is no longer the object file img as it was opened:
+// its length, modification time, inode or device differ, or it is gone
+uint32_t objfilechanged(const char *filename, const struct OBJIMAGE *img) {
+    struct stat st;
+
+    if(stat(filename, &st) != 0)
+        return TRUE;
+    if(!S_ISREG(st.st_mode))
+        return img->inode != 0;
+    return (uint64_t) st.st_size != img->filelength || STATMTIMENS(st) != img->mtime ||
+           (uint64_t) st.st_ino != img->inode || (uint64_t) st.st_dev != img->device;
+}
+
+// mapobjwindow() makes bytecount bytes from offset skipcount of the object file available, and returns
+// a pointer to them. At least OBJPADDING zero bytes are readable past the end of the file, so the
+// decoder can always read a whole instruction (or 32-byte memory image block) at the end of the window.
+//
+// The file is mapped read-only where mmap() is available. Only the pages of the window that are
+// actually read are ever faulted in, so start-up time and memory use follow the window size rather
+// than the image size. Elsewhere, just the window is read into a buffer.
+//
+// If writable, the window (and its padding) may be written, so that a memory image can be transposed
+// in place. A mapping is then private copy-on-write: the file is never changed, and only the pages
+// written take memory of their own.
+// returns NULL on failure
+
+uint8_t *mapobjwindow(struct OBJIMAGE *img, uint64_t skipcount, uint64_t bytecount, uint32_t writable) {
+    uint64_t readcount;
+
+#if defined(TM32_HAVE_MMAP)
+    if(img->fd >= 0) {
+        long pagesize = sysconf(_SC_PAGESIZE);
+        int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        uint8_t *base;
+        uint64_t pagestart;
+
+        img->maplength = ((img->filelength + OBJPADDING + pagesize - 1) / pagesize) * pagesize;
+                                                    // reserve zeroed address space for the file plus padding,
+                                                    // then map the file itself over the start of it
+        base = mmap(NULL, img->maplength, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(base == MAP_FAILED)
+            return NULL;
+        img->mapbase = base;
+        if(img->filelength > 0 &&
+            mmap(base, img->filelength, prot, MAP_PRIVATE | MAP_FIXED, img->fd, 0) == MAP_FAILED)
+            return NULL;
+#if defined(MADV_SEQUENTIAL)
+        pagestart = (skipcount / pagesize) * pagesize;
+        if(skipcount + bytecount > pagestart)
+            madvise(base + pagestart, skipcount + bytecount - pagestart, MADV_SEQUENTIAL);
+#endif
+        return base + skipcount;
+    }
+#endif
+    if(!(img->buffer = (uint8_t *) calloc(bytecount + OBJPADDING, sizeof(uint8_t))))
+        return NULL;
+    readcount = img->filelength - skipcount;        // read the padding from the file too, where there is more
+    if(readcount > bytecount + OBJPADDING)
+        readcount = bytecount + OBJPADDING;
+    if(fseek(img->fin, skipcount, SEEK_SET) != 0 || fread(img->buffer, 1, readcount, img->fin) != readcount)
+        return NULL;
+    return img->buffer;
+}
+
+// closeobjfile() releases the mapping or buffer, and the file handle, of an object file
+void closeobjfile(struct OBJIMAGE *img) {
+
+#if defined(TM32_HAVE_MMAP)
+    if(img->mapbase)
+        munmap(img->mapbase, img->maplength);
+    if(img->fd >= 0)
+        close(img->fd);
+#endif
+    if(img->buffer)
+        free(img->buffer);
+    if(img->fin)
+        fclose(img->fin);
+    memset(img, 0, sizeof(struct OBJIMAGE));
+    img->fd = -1;
+}
@@ -22,6 +22,11 @@
 #include <string.h>
 #include <inttypes.h>
 #include <getopt.h>
+#include <unistd.h>
+#if defined(__MINGW32__)
+#include <fcntl.h>
+#include <io.h>
+#endif
 #include "tm32dis.h"
 #include "tm32disinstrs.h"
 
@@ -29,12 +34,27 @@ static struct option longopts[] = {
     {"memimg",  no_argument, 0, 'm'},
     {"help",    no_argument, 0, 'h'},
     {"version", no_argument, 0, 'V'},
-    {"debug",   no_argument, 0, 'd'},
+    {"debug",   optional_argument, 0, 'd'},
     {"count",   required_argument, 0, 'c'},
     {"adjust",  required_argument, 0, 'a'},
     {"input",   required_argument, 0, 'i'},
     {"skip",    required_argument, 0, 's'},
     {"format",  required_argument, 0, 'f'},
+    {"selftest", no_argument, 0, 'T'},
+    {"threads", required_argument, 0, 't'},
+    {"range",   required_argument, 0, 'r'},
+    {"ranges",  required_argument, 0, 'R'},
+    {"stream",  no_argument, 0, 'S'},
+    {"traverse", optional_argument, 0, 'W'},
+    {"resync",  no_argument, 0, 'Y'},
+    {"build-index", required_argument, 0, 'B'},
+    {"profile", no_argument, 0, 'P'},
+    {"scan",    optional_argument, 0, 'K'},
+    {"index",   required_argument, 0, 'X'},
+    {"stats",   optional_argument, 0, 'A'},
+    {"stripe-base", required_argument, 0, 'G'},
+    {"cache-dir", required_argument, 0, 'C'},
+    {"serve",   required_argument, 0, 'Z'},
     {0, 0, 0, 0}
 };
 
@@ -49,30 +69,94 @@ static char usage_msg[] =
     "USAGE:\n" \
     " -h, --help             Displays this text\n" \
     " -v, --version          Version informaton\n" \
-    " -f, --format <n>       Output format style <n>\n" \
-    " -d, --debug            Debug output\n" \
+    " -f, --format <n>       Output format style <n>: 0 or 1 for text, json for JSON Lines,\n" \
+    "                        or bin for packed binary records\n" \
+    " -d, --debug[=<list>]   Debug output, for a comma separated list of\n" \
+    "                        unpack,decode,memimg (default all)\n" \
     " -c, --count <n>        Disassemble <n> bytes\n" \
     " -a, --adjust <offset>  Adjust offset\n" \
     " -s, --skip <n>         Skip <n> bytes\n" \
     " -i, --input <filename> TM3260 object filename\n" \
-    " -m, --memimg           Memory image (bootloader)\n\n" \
+    "     --stream           Read the input a chunk at a time, in constant memory. Reads\n" \
+    "                        standard input when there is no -i, or with -i -\n" \
+    " -m, --memimg           Memory image (bootloader)\n" \
+    "     --threads <n>      Disassemble on <n> threads (0 for one per cpu)\n" \
+    "     --range <s:c:a>    Disassemble <c> bytes from <s> at address <a>, as -s -c -a.\n" \
+    "                        May be repeated, to disassemble many ranges in one run\n" \
+    "     --ranges <file>    Disassemble each range listed in <file>, one <s:c:a> per line\n" \
+    "     --traverse[=<a>,..] Disassemble only the code reachable from the addresses <a>,\n" \
+    "                        following jumps (default the -a address)\n" \
+    "     --resync           After an illegal operation, list the bytes up to the next\n" \
+    "                        likely decision tree as data, and restart there\n" \
+    "     --build-index <f>  Write an index of the instruction boundaries to the file <f>\n" \
+    "     --index <f>        Disassemble the -s -c window straight away, with the index <f>\n" \
+    "     --stats[=json]     Print statistics of the operations, formats and decision trees,\n" \
+    "                        as text or JSON, instead of the disassembly\n" \
+    "     --scan[=<n>]       List the likely regions of code of at least <n> instructions\n" \
+    "                        (default 64) in a raw dump, as is and as a memory image\n" \
+    "     --stripe-base <n>  With -m, the bit-striped blocks start at byte <n> of the file, so\n" \
+    "                        -s may be any byte, and only the blocks decoded are transposed\n" \
+    "     --cache-dir <d>    Keep transposed memory images in the directory <d>, and reuse\n" \
+    "                        them while the image file is unchanged\n" \
+    "     --serve <socket>   Answer requests of \"<file> <address> <count> [<format>]\" on the\n" \
+    "                        Unix socket <socket>, keeping the files loaded between them\n" \
+    "     --profile          Print the time taken by each stage, and the throughput, to\n" \
+    "                        standard error as key=value lines\n" \
+    "     --selftest         Check the decode tables against the reference routines\n\n" \
     "Example:  tm32dis -s 913 -c 64 -a 0x40000000 -m -i 2701_bootrom.bin\n\n";
 
 
+// parsetracecategories() converts a comma separated list of trace category names into a TRACE_ mask.
+// returns 0 if any name is not recognised
+static uint32_t parsetracecategories(const char *list) {
+    static const struct { const char *name; uint32_t mask; } categories[] = {
+        { "unpack", TRACE_UNPACK }, { "decode", TRACE_DECODE }, { "memimg", TRACE_MEMIMG }, { "all", TRACE_ALL }
+    };
+    uint32_t i, len, mask = 0;
+
+    if(!list)
+        return TRACE_ALL;
+    while(*list) {
+        len = strcspn(list, ",");
+        for(i=0;i<sizeof(categories)/sizeof(categories[0]);i++)
+            if(len == strlen(categories[i].name) && !strncmp(list, categories[i].name, len))
+                break;
+        if(i == sizeof(categories)/sizeof(categories[0]))
+            return 0;
+        mask |= categories[i].mask;
+        list += len + (list[len] == ',');
+    }
+    return mask;
+}
+
 // main()
 //
 int main(int argc, char **argv) {
-    FILE *fin = NULL;
-    extern FILE *debugout;
+    struct OBJIMAGE objimage = { 0, -1 }, cacheimage = { 0, -1 };
     uint8_t *inputfilename = NULL;
-    void *objbuf = NULL, *objbigendbuf = NULL;
     uint64_t skipcount = 0, dismcount = 0, filelength = 0, offset = 0;
     uint8_t *instrptr;
-    uint32_t memoryimage = FALSE, debug = FALSE, outputformat = 0;
+    uint32_t memoryimage = FALSE, outputformat = 0, tracemask = 0, threads = 1;
+    struct TM32CTX ctx = { 0 };
+    struct TM32RANGE *ranges = NULL, range;
+    uint32_t rangecount = 0, streaming = FALSE, traversing = FALSE, entrycount = 0, resync = FALSE;
+    uint64_t *entries = NULL;
+    char *buildindexname = NULL, *indexname = NULL, *cachedir = NULL, *socketname = NULL;
+    int32_t outfd = STDOUT_FILENO;
+    uint32_t stats = FALSE, statsjson = FALSE;
+    struct TM32PROFILE profile = { { 0 } };
+    struct PROFILEMARK mark;
+    uint32_t profiling = FALSE;
+    uint32_t scanning = FALSE, threadsgiven = FALSE;
+    uint64_t scanmin = 0, stripebase = 0;
+    uint32_t striped = FALSE;
+    uint32_t i;
+    char *s;
+    FILE *fin;
 
     while (TRUE) {
         int32_t optidx = 0;
-        int8_t c = getopt_long(argc,argv,"mhvda:f:i:c:s:", longopts, &optidx);
+        int8_t c = getopt_long(argc,argv,"mhvd::a:f:i:c:s:", longopts, &optidx);
         if (c == -1)
             break;
 
@@ -84,9 +168,81 @@ int main(int argc, char **argv) {
             case 'v': fprintf(stdout, "%s", version_msg);
                       return 0;
                       break;
-            case 'd': debug = TRUE;
+            case 'T': return selftest();
+            case 'd': if(!(tracemask = parsetracecategories(optarg))) {
+                          fprintf(stderr, "Unknown debug category in '%s'\n", optarg);
+                          goto badexit;
+                      }
+                      break;
+            case 't': threadsgiven = TRUE;
+                      threads = strtol(optarg, NULL, 0);
+                      if(threads == 0)
+                          threads = onlinecpus();
+                      if(threads > MAXTHREADS)
+                          threads = MAXTHREADS;
+                      break;
+            case 'r': if(parserange(optarg, &range) < 0) {
+                          fprintf(stderr, "Bad range '%s', expected skip:count:addr\n", optarg);
+                          goto badexit;
+                      }
+                      if(addrange(&ranges, &rangecount, &range) < 0) {
+                          fprintf(stderr, "Could not malloc space for %u ranges\n", rangecount + 1);
+                          goto badexit;
+                      }
+                      break;
+            case 'S': streaming = TRUE;
+                      break;
+            case 'Y': resync = TRUE;
+                      break;
+            case 'P': profiling = TRUE;
+                      break;
+            case 'K': scanning = TRUE;
+                      scanmin = optarg ? strtoull(optarg, NULL, 0) : 0;
                       break;
-            case 'f': outputformat = strtol(optarg, NULL, 0);
+            case 'G': striped = TRUE;
+                      stripebase = strtoull(optarg, NULL, 0);
+                      break;
+            case 'C': cachedir = optarg;
+                      break;
+            case 'Z': socketname = optarg;
+                      break;
+            case 'B': buildindexname = optarg;
+                      break;
+            case 'X': indexname = optarg;
+                      break;
+            case 'A': stats = TRUE;
+                      if(optarg && strcmp(optarg, "json") && strcmp(optarg, "text")) {
+                          fprintf(stderr, "Unknown statistics format '%s'\n", optarg);
+                          goto badexit;
+                      }
+                      statsjson = (optarg && !strcmp(optarg, "json"));
+                      break;
+            case 'W': traversing = TRUE;
+                      for(s=optarg;s && *s;s++)                 // one entry point per comma separated address
+                          if(*s == ',')
+                              entrycount++;
+                      if(optarg && !(entries = (uint64_t *) malloc((++entrycount) * sizeof(uint64_t)))) {
+                          fprintf(stderr, "Could not malloc space for %u entry points\n", entrycount);
+                          goto badexit;
+                      }
+                      for(s=optarg, i=0;s && i<entrycount;i++) {
+                          entries[i] = strtoull(s, &s, 0);
+                          if(*s != (i == entrycount - 1 ? '\0' : ',')) {
+                              fprintf(stderr, "Bad entry point list '%s'\n", optarg);
+                              goto badexit;
+                          }
+                          s++;
+                      }
+                      break;
+            case 'R': if(readrangesfile(optarg, &ranges, &rangecount) < 0)
+                          goto badexit;
+                      break;
+            case 'f': if(!strcmp(optarg, "json"))
+                          outputformat = OUTFORMAT_JSON;
+                      else if(!strcmp(optarg, "bin"))
+                          outputformat = OUTFORMAT_BIN;
+                      else
+                          outputformat = strtol(optarg, NULL, 0);
                       break;
             case 's': skipcount = strtol(optarg, NULL, 0);
                       break;
@@ -104,29 +260,145 @@ int main(int argc, char **argv) {
         }
     }
   
-    (debugout = (debug == TRUE) ? stdout : fopen("/dev/null","w"));
-    fprintf(debugout, "Debug Enabled\n"); 
+#if defined(TM32_NOTRACE)
+    if(tracemask)
+        fprintf(stderr, "Debug output was compiled out of this build\n");
+    tracemask = 0;
+#endif
+    if(MACHINEFORMAT(outputformat) || statsjson) {          // keep standard output for the records alone, and send
+        outfd = dup(STDOUT_FILENO);                         // the messages printed through stdio to standard error
+        if(outfd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            fprintf(stderr, "Could not redirect standard output\n");
+            goto badexit;
+        }
+#if defined(__MINGW32__)
+        _setmode(outfd, _O_BINARY);
+#endif
+    }
+    if(tm32ctxinit(&ctx, outfd, outputformat) < 0) {
+        fprintf(stderr, "Could not malloc %d bytes output buffer\n", OUTBUFSIZE);
+        goto badexit;
+    }
+    ctx.tracemask = tracemask;
+    ctx.threads = threads;
+    ctx.resync = resync;
+    if(outputformat == OUTFORMAT_BIN)
+        ctx.out.len = putbinheader(ctx.out.buf) - ctx.out.buf;
+    ctx.traceout = stdout;
+    TRACE(&ctx, TRACE_ALL, "Debug Enabled\n");
+
+    if(traversing && (streaming || rangecount)) {
+        fprintf(stderr, "--traverse cannot be used with --stream, --range or --ranges\n");
+        goto badexit;
+    }
+
+    if((buildindexname || indexname) && (streaming || rangecount || traversing || resync || (buildindexname && indexname))) {
+        fprintf(stderr, "--build-index and --index cannot be used together, or with --stream, --range, --ranges, --traverse or --resync\n");
+        goto badexit;
+    }
+
+    if(stats && (streaming || rangecount || traversing || resync || buildindexname || indexname)) {
+        fprintf(stderr, "--stats cannot be used with --stream, --range, --ranges, --traverse, --resync or an index\n");
+        goto badexit;
+    }
+
+    if(scanning && (memoryimage || streaming || rangecount || traversing || resync || buildindexname || indexname || stats || profiling)) {
+        fprintf(stderr, "--scan cannot be used with -m, --stream, --range, --ranges, --traverse, --resync, an index, --stats or --profile\n");
+        goto badexit;
+    }
+    if(scanning && !threadsgiven)                           // a scan uses every cpu unless told otherwise
+        ctx.threads = onlinecpus();
+
+    if(profiling && (streaming || rangecount || traversing || resync || buildindexname || indexname || stats || tracemask)) {
+        fprintf(stderr, "--profile cannot be used with --stream, --range, --ranges, --traverse, --resync, an index, --stats or --debug\n");
+        goto badexit;
+    }
+    if(profiling) {
+        ctx.profile = &profile;
+        profilemark(&mark);
+    }
+
+    if(striped && (!memoryimage || streaming || rangecount || traversing || resync || buildindexname || indexname || stats || profiling)) {
+        fprintf(stderr, "--stripe-base needs -m, and cannot be used with --stream, --range, --ranges, --traverse, --resync, an index, --stats or --profile\n");
+        goto badexit;
+    }
+
+    if(cachedir && (!memoryimage || streaming || rangecount || striped || indexname)) {
+        fprintf(stderr, "--cache-dir needs -m, and cannot be used with --stream, --range, --ranges, --stripe-base or --index\n");
+        goto badexit;
+    }
+
+    if(resync && streaming) {
+        fprintf(stderr, "--resync cannot be used with --stream\n");
+        goto badexit;
+    }
+
+    if(socketname) {                                        // the requests name the files, and the windows of them
+        if(inputfilename || streaming || skipcount || dismcount || rangecount || traversing || resync || buildindexname || indexname ||
+           stats || profiling || scanning || striped || tracemask) {
+            fprintf(stderr, "--serve cannot be used with -i, -s, -c, --stream, --range, --ranges, --traverse, --resync, an index,\n"
+                            "--stats, --scan, --stripe-base, --profile or --debug\n");
+            goto badexit;
+        }
+        if(!threadsgiven)                                   // requests are answered on every cpu unless told otherwise
+            ctx.threads = onlinecpus();
+        if(tmserve(&ctx, socketname, memoryimage, offset, cachedir) < 0)
+            goto badexit;
+        tm32ctxfree(&ctx);
+        return 0;
+    }
+
+    if(streaming) {
+        if(rangecount) {
+            fprintf(stderr, "--range and --ranges cannot be used with --stream\n");
+            goto badexit;
+        }
+        if(!inputfilename || !strcmp(inputfilename, "-")) {
+            if(tmdisassemblestream(&ctx, stdin, NULL, memoryimage, skipcount, dismcount, offset) < 0)
+                goto badexit;
+        } else {
+            if(!(fin = fopen(inputfilename, "rb"))) {
+                fprintf(stderr, "Could not open tm32 object file '%s'\n", inputfilename);
+                goto badexit;
+            }
+            if(tmdisassemblestream(&ctx, fin, inputfilename, memoryimage, skipcount, dismcount, offset) < 0) {
+                fclose(fin);
+                goto badexit;
+            }
+            fclose(fin);
+        }
+        tm32ctxfree(&ctx);
+        return 0;
+    }
 
     if(!inputfilename) {
         fprintf(stderr, "%s\n%s", version_msg,usage_msg);
         goto badexit;
     }
-    if(!(fin=fopen(inputfilename, "rb"))) {
+    if(openobjfile(inputfilename, &objimage) < 0) {
         fprintf(stderr, "Could not open tm32 object file '%s'\n", inputfilename);
         goto badexit;
     }
+    filelength = objimage.filelength;
 
-    fseek(fin, 0L, SEEK_END);                               // find object file length
-    filelength=ftell(fin);
-    fseek(fin, 0L, SEEK_SET);
-    if(!(objbuf=(uint8_t *) malloc(filelength * sizeof(uint8_t)))) {
-        fprintf(stderr, "Could not malloc %" PRIx64 " bytes working space.\n", filelength);
-        goto badexit;
+    if(rangecount) {
+        if(skipcount || dismcount || offset) {
+            fprintf(stderr, "The -s, -c and -a options cannot be used with --range or --ranges\n");
+            goto badexit;
+        }
+        if(tmdisassembleranges(&ctx, &objimage, inputfilename, memoryimage, ranges, rangecount) < 0)
+            goto badexit;
+        tm32ctxfree(&ctx);
+        free(ranges);
+        return 0;
     }
 
-    if(fread(objbuf, 1, filelength, fin) != filelength) {
-        fprintf(stderr, "Could not read from tm32 object file '%s'\n", inputfilename);
-        goto badexit;
+    if(indexname) {
+        if(tmdisassembleindexed(&ctx, &objimage, inputfilename, indexname, memoryimage, skipcount, dismcount, offset) < 0)
+            goto badexit;
+        tm32ctxfree(&ctx);
+        closeobjfile(&objimage);
+        return 0;
     }
 
     fprintf(stdout, "Read in %" PRId64 " (0x%" PRIx64 ") bytes from file '%s'\n", filelength, filelength, inputfilename);
@@ -142,33 +414,70 @@ int main(int argc, char **argv) {
         fprintf(stdout, "Skipping %" PRId64 " (0x%" PRIx64 ") bytes\n", skipcount, skipcount);
     if(offset)
         fprintf(stdout, "Using 0x%" PRIx64 " adjustment offset\n", offset);
-    fprintf(stdout, "Disassembling %" PRId64 " (0x%" PRIx64 ") bytes\n", dismcount, dismcount);
+    fprintf(stdout, "%s %" PRId64 " (0x%" PRIx64 ") bytes\n", scanning ? "Scanning" : "Disassembling", dismcount, dismcount);
 
-    instrptr = (uint8_t *) objbuf;                          // the pointer to our instruction stream buffer
-    instrptr += skipcount;
+    if(striped) {                                           // transpose the blocks only as they are decoded
+        fprintf(stdout, "Transposing memory image blocks from 0x%" PRIx64 " as they are decoded\n", stripebase);
+        if(tmdisassemblestriped(&ctx, &objimage, stripebase, skipcount, dismcount, offset) < 0)
+            goto badexit;
+        tm32ctxfree(&ctx);
+        closeobjfile(&objimage);
+        return 0;
+    }
+                                                            // the pointer to our instruction stream buffer, which
+    if(cachedir)                                            // --cache-dir maps as an earlier run transposed it, or
+        instrptr = cachedmemimg(&ctx, cachedir, &objimage, skipcount, &cacheimage);
+    else                                                    // transposes whole and keeps for the next
+        instrptr = mapobjwindow(&objimage, skipcount, dismcount, memoryimage);
+    if(!instrptr) {
+        fprintf(stderr, "Could not read from tm32 object file '%s'\n", inputfilename);
+        goto badexit;
+    }
+    if(profiling) {
+        profiletouch(instrptr, dismcount);
+        profilestage(&profile, PROFILE_LOAD, &mark);
+    }
 
-    if(memoryimage) {
-        fprintf(stdout, "Transposing memory image from bit-striped to sequential bytes\n");
-        if(!(objbigendbuf=(uint8_t *) calloc(((dismcount / 32) + 1) * 32 * sizeof(uint8_t), 1))) {
-            fprintf(stderr, "Could not malloc %" PRId64 " bytes working space in big-endian buffer\n", dismcount);
+    if(scanning) {
+        if(tmscan(&ctx, instrptr, dismcount, skipcount, scanmin) < 0)
             goto badexit;
-        }                                                   // transform bits into sequential byte order
-        extractmemimginstructions(instrptr, objbigendbuf, ((dismcount / 32) + 1) * 32);
-        instrptr = objbigendbuf;
+        tm32ctxfree(&ctx);
+        closeobjfile(&objimage);
+        return 0;
     }
 
-    tmdisassemble(outputformat, instrptr, dismcount, offset);
+    if(memoryimage && !cachedir) {
+        if(profiling)
+            profilemark(&mark);
+        fprintf(stdout, "Transposing memory image from bit-striped to sequential bytes\n");
+        extractmemimginplace(&ctx, instrptr, MEMIMGBYTES(dismcount));   // transform bits into sequential byte order, in the
+        if(profiling)                                                   // window itself, which was mapped writable for it
+            profilestage(&profile, PROFILE_TRANSPOSE, &mark);
+    }
+
+    if(stats) {
+        if(tmstatistics(&ctx, instrptr, dismcount, offset, statsjson) < 0)
+            goto badexit;
+    } else if(buildindexname) {
+        if(tmbuildindex(instrptr, dismcount, &objimage, skipcount, memoryimage, buildindexname) < 0)
+            goto badexit;
+    } else if(traversing) {
+        if(tmdisassembletraverse(&ctx, instrptr, dismcount, offset, entries, entrycount) < 0)
+            goto badexit;
+    } else
+        tmdisassemble(&ctx, instrptr, dismcount, offset);
+    tm32ctxfree(&ctx);
+    if(profiling)
+        putprofile(&profile, stderr);
+    free(entries);
     return 0;
 
 badexit:
-    if(fin)
-        fclose(fin);
-    if(objbuf)
-        free(objbuf);
-    if(objbigendbuf)
-        free(objbigendbuf);
-    if(debugout)
-        fclose(debugout);
+    tm32ctxfree(&ctx);
+    free(ranges);
+    free(entries);
+    closeobjfile(&objimage);
+    closeobjfile(&cacheimage);
     return -1;
 }
 
@@ -31,12 +31,25 @@
 #include "tm32disinstrs.h"
 
 
-// for memory images, before disassembly, we need to transpose the instruction stream bits
-// from the 32 byte "bit-striped" blocks into standard bit and byte sequential order
-int extractmemimginstructions(uint8_t *objbuf, uint8_t *objbigendbuf, uint32_t dismcount) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define TM32_HAVE_X86_KERNELS                           // gcc can target SSE2/AVX2 per function, and
+#include <immintrin.h>                                  // pick one at run time with __builtin_cpu_supports()
+#endif
+
+
+// Each 32 byte block of a memory image holds the instruction stream "bit-striped": bit j of input
+// byte (k*8 + m) is bit m of output byte (j*4 + k). In other words, each group of 8 input bytes
+// is an 8x8 bit matrix that is transposed into every 4th byte of the output block.
 
-    uint8_t *inptr, *outptr, tempc;
-    uint32_t i, j;
+// extractmemimgbitwise() is the reference transposition, one bit at a time. Partial blocks are
+// handled, as the bits are ORed into the (zeroed) output buffer.
+void extractmemimgbitwise(const uint8_t *objbuf, uint8_t *objbigendbuf, uint64_t dismcount) {
+
+    const uint8_t *inptr;
+    uint8_t *outptr, tempc;
+    uint64_t i;
+    uint32_t j;
     for(i=0; i < dismcount; i++)
         for(j=0;j<8;j++) {
             inptr  = objbuf + i;
@@ -44,14 +57,243 @@ int extractmemimginstructions(uint8_t *objbuf, uint8_t *objbigendbuf, uint32_t d
             tempc = *inptr >> j & 1;
             *outptr |= (tempc << (i % 8));
         }
+}
+
+// transposeblocksword() transposes whole blocks, as four 8x8 bit matrices held in 64-bit words,
+// using the three-step "transpose8" from Hacker's Delight.
+static void transposeblocksword(const uint8_t *in, uint8_t *out, uint64_t blockcount) {
+    uint64_t x, t;
+    uint32_t j, k;
+
+    for(; blockcount > 0; blockcount--, in += MEMIMGBLOCK, out += MEMIMGBLOCK)
+        for(k=0;k<4;k++) {
+            x = (uint64_t) in[k*8]          | (uint64_t) in[k*8+1] << 8  | (uint64_t) in[k*8+2] << 16 |
+                (uint64_t) in[k*8+3] << 24  | (uint64_t) in[k*8+4] << 32 | (uint64_t) in[k*8+5] << 40 |
+                (uint64_t) in[k*8+6] << 48  | (uint64_t) in[k*8+7] << 56;
+            t = (x ^ (x >> 7))  & 0x00aa00aa00aa00aaULL;    x ^= t ^ (t << 7);
+            t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;    x ^= t ^ (t << 14);
+            t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;    x ^= t ^ (t << 28);
+            for(j=0;j<8;j++)                                // byte j of x now holds bit j of the 8 input bytes
+                out[j*4+k] = (uint8_t) (x >> (j*8));
+        }
+}
+
+#if defined(TM32_HAVE_X86_KERNELS)
+// The SIMD kernels gather bit 7 of every byte in a vector with movemask, then add the vector to itself
+// to shift the next bit up into bit 7 of each byte. So bit j of the input bytes gives output row j.
+
+// transposeblockssse2() transposes a block as two 16 byte vectors, giving two bytes of each row
+__attribute__((target("sse2")))
+static void transposeblockssse2(const uint8_t *in, uint8_t *out, uint64_t blockcount) {
+    __m128i lo, hi;
+    uint32_t masklo, maskhi;
+    int32_t j;
+
+    for(; blockcount > 0; blockcount--, in += MEMIMGBLOCK, out += MEMIMGBLOCK) {
+        lo = _mm_loadu_si128((const __m128i *) in);
+        hi = _mm_loadu_si128((const __m128i *) (in + 16));
+        for(j=7;j>=0;j--) {
+            masklo = _mm_movemask_epi8(lo);
+            maskhi = _mm_movemask_epi8(hi);
+            out[j*4]   = (uint8_t) masklo;
+            out[j*4+1] = (uint8_t) (masklo >> 8);
+            out[j*4+2] = (uint8_t) maskhi;
+            out[j*4+3] = (uint8_t) (maskhi >> 8);
+            lo = _mm_add_epi8(lo, lo);
+            hi = _mm_add_epi8(hi, hi);
+        }
+    }
+}
+
+// transposeblocksavx2() transposes a block as one 32 byte vector, giving a whole row of 4 bytes at a time
+__attribute__((target("avx2")))
+static void transposeblocksavx2(const uint8_t *in, uint8_t *out, uint64_t blockcount) {
+    __m256i v;
+    uint32_t mask;
+    int32_t j;
+
+    for(; blockcount > 0; blockcount--, in += MEMIMGBLOCK, out += MEMIMGBLOCK) {
+        v = _mm256_loadu_si256((const __m256i *) in);
+        for(j=7;j>=0;j--) {
+            mask = _mm256_movemask_epi8(v);
+            out[j*4]   = (uint8_t) mask;
+            out[j*4+1] = (uint8_t) (mask >> 8);
+            out[j*4+2] = (uint8_t) (mask >> 16);
+            out[j*4+3] = (uint8_t) (mask >> 24);
+            v = _mm256_add_epi8(v, v);
+        }
+    }
+}
+#endif
+
+struct MEMIMGKERNEL {
+    const char *name;
+    void (*transposeblocks)(const uint8_t *in, uint8_t *out, uint64_t blockcount);
+    uint32_t (*supported)(void);
+    uint32_t inplace;                                   // TRUE if it reads a whole block before writing any of it
+};
+
+static uint32_t kernelalways(void) {
+    return TRUE;
+}
+
+#if defined(TM32_HAVE_X86_KERNELS)
+static uint32_t kernelsse2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2") ? TRUE : FALSE;
+}
+
+static uint32_t kernelavx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? TRUE : FALSE;
+}
+#endif
+
+// memimgkernels[] lists the transposition kernels, fastest first
+static const struct MEMIMGKERNEL memimgkernels[] = {
+#if defined(TM32_HAVE_X86_KERNELS)
+    { "avx2",   transposeblocksavx2,    kernelavx2,     TRUE },
+    { "sse2",   transposeblockssse2,    kernelsse2,     TRUE },
+#endif
+    { "word",   transposeblocksword,    kernelalways,   FALSE },
+    { NULL,     NULL,                   NULL,           FALSE }
+};
+
+static const struct MEMIMGKERNEL *memimgkernel = NULL;
+
+// initmemimgkernel() selects the fastest transposition kernel that the host cpu supports
+void initmemimgkernel(void) {
+    const struct MEMIMGKERNEL *k;
+
+    if(memimgkernel)
+        return;
+    for(k=memimgkernels; !k->supported(); k++)
+        ;
+    memimgkernel = k;
+}
+
+// transposememimg() transposes dismcount bytes from bit-striped blocks into sequential order, a whole
+// block at a time with the selected kernel. Any partial block at the end is done one bit at a time.
+static void transposememimg(const struct MEMIMGKERNEL *k, const uint8_t *objbuf, uint8_t *objbigendbuf, uint64_t dismcount) {
+    uint32_t tail = dismcount % MEMIMGBLOCK;
+
+    k->transposeblocks(objbuf, objbigendbuf, dismcount / MEMIMGBLOCK);
+    if(tail) {
+        memset(objbigendbuf + dismcount - tail, 0, MEMIMGBLOCK);
+        extractmemimgbitwise(objbuf + dismcount - tail, objbigendbuf + dismcount - tail, tail);
+    }
+}
+
+// transposememimgblock() transposes the count bytes (at most one block) of bit-striped block at in to
+// out, with the selected kernel if the block is whole, else one bit at a time as if it ended in zeros
+void transposememimgblock(const uint8_t *in, uint8_t *out, uint32_t count) {
+
+    if(count == MEMIMGBLOCK) {
+        memimgkernel->transposeblocks(in, out, 1);
+        return;
+    }
+    memset(out, 0, MEMIMGBLOCK);
+    extractmemimgbitwise(in, out, count);
+}
+
+// transposememimginplace() transposes dismcount bytes of bit-striped blocks at objbuf in place. A kernel
+// that reads each block whole before writing it is run over them all; any other transposes each block
+// into one block of scratch, which is copied back. A partial block at the end is taken as ending in
+// zeros, and is written whole, so the buffer must have room for it, as the output of transposememimg() must.
+static void transposememimginplace(const struct MEMIMGKERNEL *k, uint8_t *objbuf, uint64_t dismcount) {
+    uint8_t scratch[MEMIMGBLOCK];
+    uint64_t i, blocks = dismcount / MEMIMGBLOCK;
+    uint32_t tail = dismcount % MEMIMGBLOCK;
+
+    if(k->inplace)
+        k->transposeblocks(objbuf, objbuf, blocks);
+    else
+        for(i=0;i<blocks;i++) {
+            k->transposeblocks(objbuf + i * MEMIMGBLOCK, scratch, 1);
+            memcpy(objbuf + i * MEMIMGBLOCK, scratch, MEMIMGBLOCK);
+        }
+    if(tail) {
+        memset(scratch, 0, MEMIMGBLOCK);
+        extractmemimgbitwise(objbuf + dismcount - tail, scratch, tail);
+        memcpy(objbuf + dismcount - tail, scratch, MEMIMGBLOCK);
+    }
+}
+
+static void tracememimg(struct TM32CTX *ctx, const uint8_t *objbigendbuf, uint64_t dismcount) {
+    uint64_t i;
+    uint32_t j;
 
     for(i=0; i< dismcount; i+= 16) {
-        fprintf(debugout, "%04x: ", i);
+        fprintf(ctx->traceout, "%04" PRIx64 ": ", i);
         for(j=0;j<16;j++)
-            fprintf(debugout, "%02x ", objbigendbuf[i+j]);
-        fprintf(debugout, "\n");
+            fprintf(ctx->traceout, "%02x ", objbigendbuf[i+j]);
+        fprintf(ctx->traceout, "\n");
+    }
+    fprintf(ctx->traceout, "\n");
+}
+
+// for memory images, before disassembly, we need to transpose the instruction stream bits
+// from the 32 byte "bit-striped" blocks into standard bit and byte sequential order
+int extractmemimginstructions(struct TM32CTX *ctx, uint8_t *objbuf, uint8_t *objbigendbuf, uint64_t dismcount) {
+
+    transposememimg(memimgkernel, objbuf, objbigendbuf, dismcount);
+
+    if(TRACING(ctx, TRACE_MEMIMG))
+        tracememimg(ctx, objbigendbuf, dismcount);
+    return 0;
+}
+
+// extractmemimginplace() transposes a memory image as extractmemimginstructions() does, but in the
+// buffer it is in, so that no second buffer the size of the image is needed
+int extractmemimginplace(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t dismcount) {
+
+    transposememimginplace(memimgkernel, objbuf, dismcount);
+
+    if(TRACING(ctx, TRACE_MEMIMG))
+        tracememimg(ctx, objbuf, dismcount);
+    return 0;
+}
+
+// checkmemimgkernels() compares the output of each transposition kernel that the host supports, to
+// another buffer and in place, byte for byte, against the reference bitwise routine, over random
+// data including a partial block.
+// returns the count of kernels that disagree
+
+uint32_t checkmemimgkernels(void) {
+    const struct MEMIMGKERNEL *k;
+    uint8_t *in, *ref, *out;
+    uint32_t i, count = 4096 + 17, errors = 0;
+
+    in  = (uint8_t *) malloc(count);
+    ref = (uint8_t *) calloc(count + MEMIMGBLOCK, 1);
+    out = (uint8_t *) malloc(count + MEMIMGBLOCK);
+    if(!in || !ref || !out) {
+        free(in); free(ref); free(out);
+        return 1;
+    }
+    srand(0x7e3260);
+    for(i=0;i<count;i++)
+        in[i] = (uint8_t) (rand() >> 4);
+    extractmemimgbitwise(in, ref, count);
+
+    for(k=memimgkernels; k->name; k++) {
+        if(!k->supported()) {
+            fprintf(stdout, "memimg kernel %-5s : not supported by this cpu\n", k->name);
+            continue;
+        }
+        memset(out, 0x5a, count + MEMIMGBLOCK);
+        transposememimg(k, in, out, count);
+        i = memcmp(out, ref, count);
+        memcpy(out, in, count);                                     // and in place
+        memset(out + count, 0x5a, MEMIMGBLOCK);
+        transposememimginplace(k, out, count);
+        i |= memcmp(out, ref, count);
+        fprintf(stdout, "memimg kernel %-5s : %s\n", k->name, i ? "FAILED" : "ok");
+        if(i)
+            errors++;
     }
-    fprintf(debugout, "\n");
+    free(in); free(ref); free(out);
+    return errors;
 }
 
 // reverse bitcount bits starting at bitoffset in byte array ptr.
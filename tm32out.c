@@ -0,0 +1,214 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com> 
+//     
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "tm32dis.h"
+
+
+// The disassembly is written into a large append-only buffer with the put...() functions below,
+// which replace sprintf() for the handful of conversions the disassembler needs. The buffer is
+// flushed to the output file descriptor with large write() calls.
+
+// regnames[] holds the pre-built names of the 128 TM3260 registers
+static const uint8_t regnames[128][5] = {
+    "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+    "r16", "r17", "r18", "r19", "r20", "r21", "r22", "r23", "r24", "r25", "r26", "r27", "r28", "r29", "r30", "r31",
+    "r32", "r33", "r34", "r35", "r36", "r37", "r38", "r39", "r40", "r41", "r42", "r43", "r44", "r45", "r46", "r47",
+    "r48", "r49", "r50", "r51", "r52", "r53", "r54", "r55", "r56", "r57", "r58", "r59", "r60", "r61", "r62", "r63",
+    "r64", "r65", "r66", "r67", "r68", "r69", "r70", "r71", "r72", "r73", "r74", "r75", "r76", "r77", "r78", "r79",
+    "r80", "r81", "r82", "r83", "r84", "r85", "r86", "r87", "r88", "r89", "r90", "r91", "r92", "r93", "r94", "r95",
+    "r96", "r97", "r98", "r99", "r100", "r101", "r102", "r103", "r104", "r105", "r106", "r107", "r108", "r109", "r110", "r111",
+    "r112", "r113", "r114", "r115", "r116", "r117", "r118", "r119", "r120", "r121", "r122", "r123", "r124", "r125", "r126", "r127",
+};
+
+static const uint8_t hexdigits[] = "0123456789abcdef";
+
+// putstr() copies the string s to p, and returns a pointer to the end of the copy
+uint8_t *putstr(uint8_t *p, const uint8_t *s) {
+    while(*s)
+        *p++ = *s++;
+    return p;
+}
+
+// putreg() writes the name of register r (e.g. "r12") to p
+uint8_t *putreg(uint8_t *p, uint32_t r) {
+    r &= 0x7f;
+    memcpy(p, regnames[r], 4);
+    return p + (r < 10 ? 2 : (r < 100 ? 3 : 4));
+}
+
+// putudec() writes v in unsigned decimal (as "%u") to p
+uint8_t *putudec(uint8_t *p, uint32_t v) {
+    uint8_t digits[10];
+    uint32_t n = 0;
+
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while(v);
+    while(n)
+        *p++ = digits[--n];
+    return p;
+}
+
+// putudec64() writes the 64-bit v in unsigned decimal (as "%" PRIu64) to p
+uint8_t *putudec64(uint8_t *p, uint64_t v) {
+    uint8_t digits[20];
+    uint32_t n = 0;
+
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while(v);
+    while(n)
+        *p++ = digits[--n];
+    return p;
+}
+
+// putdec() writes v in signed decimal (as "%d") to p
+uint8_t *putdec(uint8_t *p, int32_t v) {
+    if(v < 0) {
+        *p++ = '-';
+        return putudec(p, 0 - (uint32_t) v);
+    }
+    return putudec(p, (uint32_t) v);
+}
+
+// putle() writes the low bytes bytes of v in little endian order to p
+uint8_t *putle(uint8_t *p, uint64_t v, uint32_t bytes) {
+    while(bytes--) {
+        *p++ = v & 0xff;
+        v >>= 8;
+    }
+    return p;
+}
+
+// getle() reads bytes bytes in little endian order from p, as putle() wrote them
+uint64_t getle(const uint8_t *p, uint32_t bytes) {
+    uint64_t v = 0;
+
+    while(bytes--)
+        v = (v << 8) | p[bytes];
+    return v;
+}
+
+// puthex() writes v in lower case hex (as "%0<mindigits>x") to p
+uint8_t *puthex(uint8_t *p, uint64_t v, uint32_t mindigits) {
+    uint8_t digits[16];
+    uint32_t n = 0;
+
+    do {
+        digits[n++] = hexdigits[v & 0xf];
+        v >>= 4;
+    } while(v);
+    while(n < mindigits)
+        digits[n++] = '0';
+    while(n)
+        *p++ = digits[--n];
+    return p;
+}
+
+// putpad() pads with spaces from p, until the field that began at start is width characters wide
+uint8_t *putpad(uint8_t *p, const uint8_t *start, uint32_t width) {
+    while(p < start + width)
+        *p++ = ' ';
+    return p;
+}
+
+// outinit() allocates an output buffer of size bytes, to be written to file descriptor fd.
+// A caller that wants the text somewhere else sets out->sink (and out->sinkarg) afterwards.
+// returns 0 on success, -1 if the buffer could not be allocated
+int32_t outinit(struct OUTBUF *out, int32_t fd, size_t size) {
+    out->len = 0;
+    out->size = size;
+    out->fd = fd;
+    out->sink = NULL;
+    out->sinkarg = NULL;
+    out->flushlimit = size - OUTRESERVE;
+    if(!(out->buf = (uint8_t *) malloc(size)))
+        return -1;
+    return 0;
+}
+
+// outwrite() passes len bytes at buf straight to the sink if there is one, else to the file
+// descriptor. When that is stdout, anything still buffered by stdio there (e.g. the banner printed
+// by main()) is flushed first, so the two streams stay in order.
+static void outwrite(struct OUTBUF *out, const uint8_t *buf, size_t len) {
+    const uint8_t *p = buf;
+    ssize_t n;
+
+    if(out->sink) {
+        if(len)
+            out->sink(out->sinkarg, buf, len);
+        return;
+    }
+    if(out->fd == STDOUT_FILENO)
+        fflush(stdout);
+    while(p < buf + len) {
+        if((n = write(out->fd, p, buf + len - p)) < 0) {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        p += n;
+    }
+}
+
+// outflush() writes out everything in the buffer
+void outflush(struct OUTBUF *out) {
+    outwrite(out, out->buf, out->len);
+    out->len = 0;
+}
+
+// outsync() records that the buffer has been filled up to p, and flushes it once it is
+// over the flush limit. returns the position from which to continue writing
+uint8_t *outsync(struct OUTBUF *out, uint8_t *p) {
+    out->len = p - out->buf;
+    if(out->len > out->flushlimit)
+        outflush(out);
+    return out->buf + out->len;
+}
+
+// outappend() adds len bytes of already rendered text at buf to the output. Text that would not
+// fit in the buffer is written out directly, rather than copied through it
+void outappend(struct OUTBUF *out, const uint8_t *buf, size_t len) {
+    if(len > out->size - out->len) {
+        outflush(out);
+        if(len > out->flushlimit) {
+            outwrite(out, buf, len);
+            return;
+        }
+    }
+    memcpy(out->buf + out->len, buf, len);
+    out->len += len;
+    if(out->len > out->flushlimit)
+        outflush(out);
+}
+
+// outfree() flushes and then releases an output buffer
+void outfree(struct OUTBUF *out) {
+    outflush(out);
+    free(out->buf);
+    out->buf = NULL;
+}
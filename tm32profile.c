@@ -0,0 +1,197 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com>
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined(__MINGW32__)
+#define _DEFAULT_SOURCE                             // for clock_gettime() under -std=c99
+#define _BSD_SOURCE
+#define _POSIX_C_SOURCE 199309L
+#endif
+#if defined(__MINGW32__)
+#include "windows/byteswap.h"
+#include <windows.h>
+#else
+#include <byteswap.h>
+#include <time.h>
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "tm32dis.h"
+
+
+// Profiling splits the linear sweep into its stages and runs each over a batch of PROFILEBATCH
+// instructions before the next, so that the clocks are read a few times per batch rather than for
+// every instruction, and the time of each stage is its own. The text is the same as without
+// --profile. Nothing here is called unless --profile is given.
+
+#define PROFILEBATCH    4096                            //   instructions taken through each stage at a time
+#define PROFILEPAGE     4096                            //   bytes apart that profiletouch() reads
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define CYCLECOUNTER    "rdtsc"
+#define READCYCLES()    __builtin_ia32_rdtsc()
+#else
+#define CYCLECOUNTER    "none"                          //   the cycles are reported as 0
+#define READCYCLES()    0
+#endif
+
+static const char *stagenames[PROFILE_STAGES] = { "load", "transpose", "chain", "unpack", "decode", "render" };
+
+// profilemark() reads the clocks into mark, at the start of a stage
+void profilemark(struct PROFILEMARK *mark) {
+#if defined(__MINGW32__)
+    LARGE_INTEGER count, frequency;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    mark->ns = (uint64_t) (count.QuadPart * 1e9 / frequency.QuadPart);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    mark->ns = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    mark->cycles = READCYCLES();
+}
+
+// profilestage() adds the time since mark to stage of prof
+void profilestage(struct TM32PROFILE *prof, uint32_t stage, const struct PROFILEMARK *mark) {
+    struct PROFILEMARK now;
+
+    profilemark(&now);
+    prof->ns[stage] += now.ns - mark->ns;
+    prof->cycles[stage] += now.cycles - mark->cycles;
+}
+
+// profiletouch() reads a byte of every page of the count bytes at buf, so that the pages of a mapped
+// file are read in as part of the load, rather than by whichever stage first looks at them
+void profiletouch(const uint8_t *buf, uint64_t count) {
+    volatile uint8_t sink = 0;
+    uint64_t i;
+
+    for(i=0;i<count;i+=PROFILEPAGE)
+        sink ^= buf[i];
+    if(count)
+        sink ^= buf[count - 1];
+}
+
+// disassembleprofiled() renders the instructions of span in objbuf as disassemblespan() does, timing
+// each stage into ctx->profile. returns a pointer to the end of the text
+uint8_t *disassembleprofiled(struct TM32CTX *ctx, struct OUTBUF *out, uint8_t *p, uint8_t *objbuf, struct TM32SPAN *span) {
+
+    struct TM32PROFILE *prof = ctx->profile;
+    struct PROFILEMARK mark;
+    struct TM32INSTR *ins;
+    const struct FORMATDESC *fd;
+    uint64_t *pos, next = span->start, offset = span->offset;
+    uint16_t formatfield = span->formatfield;
+    uint32_t insnum = span->insnum, count, i, slot;
+
+    ins = (struct TM32INSTR *) malloc(PROFILEBATCH * sizeof(struct TM32INSTR));
+    pos = (uint64_t *) malloc(PROFILEBATCH * sizeof(uint64_t));
+    if(!ins || !pos) {                                              // profile nothing, rather than print nothing
+        fprintf(stderr, "Could not malloc space to profile, disassembling without\n");
+        free(ins);
+        free(pos);
+        return disassemblespan(ctx, out, p, objbuf, span);
+    }
+
+    while(next < span->end) {
+        profilemark(&mark);                                         // the instruction boundaries of a batch
+        for(count=0;count<PROFILEBATCH && next<span->end;count++) {
+            fd = GETFORMATDESC(formatfield);
+            pos[count] = next;
+            ins[count].offset = offset + (next - span->start);
+            ins[count].formatfield = formatfield;
+            ins[count].length = fd->inslength / 8;
+            memcpy(&formatfield, objbuf + next, 2);                 // format field for the next instruction
+            ins[count].nextformatfield = formatfield;
+            next += ins[count].length;
+        }
+        profilestage(prof, PROFILE_CHAIN, &mark);
+
+        profilemark(&mark);
+        for(i=0;i<count;i++)
+            unpackinstruction(objbuf + pos[i], ins[i].formatfield, ins[i].opbits);
+        profilestage(prof, PROFILE_UNPACK, &mark);
+
+        profilemark(&mark);
+        for(i=0;i<count;i++) {
+            fd = GETFORMATDESC(ins[i].formatfield);
+            for(slot=0;slot<MAXSLOT;slot++) {
+                decodeoperation(ctx, fd->opsize[slot], ins[i].opbits[slot], &ins[i].op[slot]);
+                prof->operations += (ins[i].op[slot].size != 0);
+            }
+        }
+        profilestage(prof, PROFILE_DECODE, &mark);
+
+        profilemark(&mark);
+        for(i=0;i<count;i++) {
+            p = outsync(out, p);
+            insnum = (ins[i].length * 8 == MAXTM32INSLEN) ? 0 : insnum + 1;
+            p = renderinstruction(p, ctx->printoutformat, &ins[i], objbuf + pos[i], insnum);
+        }
+        profilestage(prof, PROFILE_RENDER, &mark);
+        prof->instructions += count;
+    }
+
+    profilemark(&mark);                                             // the text still in the buffer is written as part of the render
+    p = outsync(out, p);
+    outflush(out);
+    p = out->buf;
+    profilestage(prof, PROFILE_RENDER, &mark);
+
+    prof->bytes += next - span->start;
+    span->offset = offset + (next - span->start);
+    span->start = next;
+    span->formatfield = formatfield;
+    span->insnum = insnum;
+    free(ins);
+    free(pos);
+    return p;
+}
+
+// putprofile() prints the timings in prof to fout, as one key=value pair on each line. A stage that
+// did not run has a time of 0. The rates are over the time of all the stages together
+void putprofile(const struct TM32PROFILE *prof, FILE *fout) {
+    uint64_t ns = 0, cycles = 0;
+    double seconds;
+    uint32_t i;
+
+    for(i=0;i<PROFILE_STAGES;i++) {
+        ns += prof->ns[i];
+        cycles += prof->cycles[i];
+    }
+    seconds = ns ? ns / 1e9 : 1e-9;
+    fprintf(fout, "profile.cyclecounter=%s\n", CYCLECOUNTER);
+    for(i=0;i<PROFILE_STAGES;i++) {
+        fprintf(fout, "profile.%s.ns=%" PRIu64 "\n", stagenames[i], prof->ns[i]);
+        fprintf(fout, "profile.%s.cycles=%" PRIu64 "\n", stagenames[i], prof->cycles[i]);
+    }
+    fprintf(fout, "profile.total.ns=%" PRIu64 "\n", ns);
+    fprintf(fout, "profile.total.cycles=%" PRIu64 "\n", cycles);
+    fprintf(fout, "profile.bytes=%" PRIu64 "\n", prof->bytes);
+    fprintf(fout, "profile.instructions=%" PRIu64 "\n", prof->instructions);
+    fprintf(fout, "profile.operations=%" PRIu64 "\n", prof->operations);
+    fprintf(fout, "profile.bytes_per_s=%.0f\n", prof->bytes / seconds);
+    fprintf(fout, "profile.instructions_per_s=%.0f\n", prof->instructions / seconds);
+    fprintf(fout, "profile.operations_per_s=%.0f\n", prof->operations / seconds);
+}
@@ -0,0 +1,290 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com>
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#if defined(__MINGW32__)
+#include "windows/byteswap.h"
+#else
+#include <byteswap.h>
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include "tm32dis.h"
+
+
+// Batch range mode disassembles many windows of one object file, each given as skip:count:addr
+// like the -s, -c and -a options, in a single run. The file is loaded once. A memory image is
+// transposed in extents: ranges whose skip counts have the same block phase, and whose blocks overlap
+// or touch, share one extent and are transposed once, while the gaps between ranges are never read.
+// The text of each window is exactly what a separate run with -s, -c and -a would print.
+
+#define MEMIMGPHASES    32                              //   bytes in each bit-striped block
+
+// struct RANGEEXTENT is a run of bit-striped blocks transposed once for the ranges that lie in it
+
+struct RANGEEXTENT {
+    uint64_t start;                                     //   byte of the file at the first block
+    uint64_t end;                                       //   byte of the file after the last block
+    uint8_t *buf;                                       //   the transposed bytes
+};
+
+// struct RANGEJOBS is the job list for renderordered(): one job per range
+
+struct RANGEJOBS {
+    const struct TM32RANGE *ranges;
+    uint8_t **instrptrs;                                //   the instruction stream of each range
+    const char *filename;
+    uint64_t filelength;
+    uint32_t memoryimage;
+};
+
+// parserange() parses a range of the form skip:count:addr into range. count and addr may be left
+// out or left empty, and count is 0 for the rest of the file. Blanks may separate the fields instead of colons.
+// returns 0 on success, -1 if str is not a range
+
+int32_t parserange(const char *str, struct TM32RANGE *range) {
+    uint64_t field[3] = { 0, 0, 0 };
+    uint32_t i = 0;
+    char *end;
+
+    while(TRUE) {
+        while(isspace((unsigned char) *str))
+            str++;
+        if(isdigit((unsigned char) *str)) {
+            field[i] = strtoull(str, &end, 0);
+            for(str = end; isspace((unsigned char) *str); str++)
+                ;
+        } else if(*str != ':')                                      // only an empty field may have no digits
+            return -1;
+        i++;
+        if(*str == ':')
+            str++;
+        else if(!*str || *str == '#')
+            break;
+        if(i == 3)
+            return -1;
+    }
+    range->skip = field[0];
+    range->count = field[1];
+    range->offset = field[2];
+    return 0;
+}
+
+// addrange() appends range to the growable array *ranges of *count ranges.
+// returns 0 on success, -1 if out of memory
+
+int32_t addrange(struct TM32RANGE **ranges, uint32_t *count, const struct TM32RANGE *range) {
+    struct TM32RANGE *grown;
+
+    if(!(*count & (*count - 1))) {                                  // grow at each power of two
+        if(!(grown = (struct TM32RANGE *) realloc(*ranges, (*count ? *count * 2 : 1) * sizeof(struct TM32RANGE))))
+            return -1;
+        *ranges = grown;
+    }
+    (*ranges)[(*count)++] = *range;
+    return 0;
+}
+
+// readrangesfile() appends the ranges listed in filename, one skip:count:addr per line, to the
+// array *ranges of *count ranges. Blank lines, and anything after a #, are ignored.
+// returns 0 on success, -1 on error (which is reported)
+
+int32_t readrangesfile(const char *filename, struct TM32RANGE **ranges, uint32_t *count) {
+    struct TM32RANGE range;
+    char line[256], *s;
+    uint32_t linenum = 0;
+    FILE *fin;
+
+    if(!(fin = fopen(filename, "r"))) {
+        fprintf(stderr, "Could not open ranges file '%s'\n", filename);
+        return -1;
+    }
+    while(fgets(line, sizeof(line), fin)) {
+        linenum++;
+        for(s=line; isspace((unsigned char) *s); s++)
+            ;
+        if(!*s || *s == '#')
+            continue;
+        if(parserange(s, &range) < 0) {
+            fprintf(stderr, "Bad range at line %u of ranges file '%s'\n", linenum, filename);
+            fclose(fin);
+            return -1;
+        }
+        if(addrange(ranges, count, &range) < 0) {
+            fprintf(stderr, "Could not malloc space for %u ranges\n", *count + 1);
+            fclose(fin);
+            return -1;
+        }
+    }
+    fclose(fin);
+    return 0;
+}
+
+// putrangebanner() writes the lines that a single run prints before the disassembly of range r
+static uint8_t *putrangebanner(uint8_t *p, const struct RANGEJOBS *jobs, const struct TM32RANGE *r) {
+    char *s = (char *) p;
+
+    s += snprintf(s, OUTRESERVE / 2, "Read in %" PRId64 " (0x%" PRIx64 ") bytes from file '%s'\n",
+                  jobs->filelength, jobs->filelength, jobs->filename);
+    if(r->skip)
+        s += sprintf(s, "Skipping %" PRId64 " (0x%" PRIx64 ") bytes\n", r->skip, r->skip);
+    if(r->offset)
+        s += sprintf(s, "Using 0x%" PRIx64 " adjustment offset\n", r->offset);
+    s += sprintf(s, "Disassembling %" PRId64 " (0x%" PRIx64 ") bytes\n", r->count, r->count);
+    if(jobs->memoryimage)
+        s += sprintf(s, "Transposing memory image from bit-striped to sequential bytes\n");
+    return (uint8_t *) s;
+}
+
+static uint8_t *renderrangejob(struct TM32CTX *ctx, struct OUTBUF *out, uint8_t *p, void *arg, uint64_t index) {
+    struct RANGEJOBS *jobs = (struct RANGEJOBS *) arg;
+    const struct TM32RANGE *r = &jobs->ranges[index];
+    struct TM32SPAN span = { 0, r->count, r->offset, 0, 0 };
+
+    span.formatfield = bswap_16(BRTARGETFORMATBYTES);
+    p = outsync(out, p);
+    if(!MACHINEFORMAT(ctx->printoutformat))
+        p = putrangebanner(p, jobs, r);
+    p = putdisassemblystart(ctx, p);
+    if(ctx->threads > 1 && !TRACING(ctx, TRACE_ALL))                // a lone range can still be split across threads
+        p = disassemblethreaded(ctx, p, jobs->instrptrs[index], r->count, r->offset);
+    else
+        p = disassemblespan(ctx, out, p, jobs->instrptrs[index], &span);
+    return putdisassemblyend(ctx, p);
+}
+
+// struct RANGEORDER is a range in the order that its extent is found
+
+struct RANGEORDER {
+    uint64_t skip;
+    uint32_t index;                                     //   of the range
+    uint32_t extent;                                    //   index of the extent that holds it
+};
+
+// comparerangephase() orders ranges by the block phase of their skip counts, then by skip
+static int comparerangephase(const void *a, const void *b) {
+    const struct RANGEORDER *x = (const struct RANGEORDER *) a, *y = (const struct RANGEORDER *) b;
+
+    if(x->skip % MEMIMGPHASES != y->skip % MEMIMGPHASES)
+        return (x->skip % MEMIMGPHASES > y->skip % MEMIMGPHASES) - (x->skip % MEMIMGPHASES < y->skip % MEMIMGPHASES);
+    return (x->skip > y->skip) - (x->skip < y->skip);
+}
+
+// tmdisassembleranges() disassembles each of the count ranges of the object file img, named filename,
+// in turn, transposing it first if memoryimage. With ctx->threads above one, the ranges are
+// disassembled in parallel, but the text is still written in the order of the ranges.
+// returns 0 on success, -1 on error (which is reported)
+
+int32_t tmdisassembleranges(struct TM32CTX *ctx, struct OBJIMAGE *img, const char *filename, uint32_t memoryimage, struct TM32RANGE *ranges, uint32_t count) {
+
+    struct RANGEJOBS jobs;
+    struct OUTBUF *out = &ctx->out;
+    struct RANGEEXTENT *extents = NULL, *e = NULL;
+    struct RANGEORDER *order = NULL;
+    uint8_t *objbuf;
+    uint64_t filelength = img->filelength, end;
+    uint32_t i, j, extentcount = 0;
+    int32_t ret = -1;
+    uint8_t *p;
+
+    for(i=0;i<count;i++) {
+        if(ranges[i].skip > filelength || ranges[i].count > filelength - ranges[i].skip) {
+            fprintf(stderr, "Range %u (0x%" PRIx64 ":0x%" PRIx64 "): Count parameter too large for file length\n",
+                    i + 1, ranges[i].skip, ranges[i].count);
+            return -1;
+        }
+        if(ranges[i].count == 0)                                    // the count of bytes to disassemble
+            ranges[i].count = filelength - ranges[i].skip;
+    }
+
+    jobs.ranges = ranges;
+    jobs.filename = filename;
+    jobs.filelength = filelength;
+    jobs.memoryimage = memoryimage;
+    if(!(jobs.instrptrs = (uint8_t **) malloc(count * sizeof(uint8_t *)))) {
+        fprintf(stderr, "Could not malloc space for %u ranges\n", count);
+        return -1;
+    }
+    if(!(objbuf = mapobjwindow(img, 0, filelength, FALSE))) {
+        fprintf(stderr, "Could not read from tm32 object file '%s'\n", filename);
+        goto done;
+    }
+
+    for(i=0;i<count;i++)
+        jobs.instrptrs[i] = objbuf + ranges[i].skip;
+
+    if(memoryimage) {
+        order = (struct RANGEORDER *) malloc(count * sizeof(struct RANGEORDER));
+        extents = (struct RANGEEXTENT *) calloc(count, sizeof(struct RANGEEXTENT));
+        if(!order || !extents) {
+            fprintf(stderr, "Could not malloc space for %u ranges\n", count);
+            goto done;
+        }
+        for(i=0;i<count;i++) {                                      // take the ranges by block phase, then skip
+            order[i].skip = ranges[i].skip;
+            order[i].index = i;
+        }
+        qsort(order, count, sizeof(struct RANGEORDER), comparerangephase);
+
+        for(i=0;i<count;i++) {                                      // and join those whose blocks overlap or touch
+            j = order[i].index;
+            end = ranges[j].skip + MEMIMGBYTES(ranges[j].count);
+            if(e && ranges[j].skip % MEMIMGPHASES == e->start % MEMIMGPHASES && ranges[j].skip <= e->end) {
+                if(end > e->end)
+                    e->end = end;
+            } else {
+                e = &extents[extentcount++];
+                e->start = ranges[j].skip;
+                e->end = end;
+            }
+            order[i].extent = e - extents;
+        }
+        for(i=0;i<extentcount;i++) {                                // then transpose each extent once
+            e = &extents[i];
+            if(!(e->buf = (uint8_t *) calloc(e->end - e->start, 1))) {
+                fprintf(stderr, "Could not malloc %" PRId64 " bytes working space in big-endian buffer\n", e->end - e->start);
+                goto done;
+            }
+            extractmemimginstructions(ctx, objbuf + e->start, e->buf, e->end - e->start);
+        }
+        for(i=0;i<count;i++) {
+            e = &extents[order[i].extent];
+            jobs.instrptrs[order[i].index] = e->buf + order[i].skip - e->start;
+        }
+    }
+
+    if(TRACING(ctx, TRACE_ALL))                                     // trace output may share the stream through stdio, so
+        out->flushlimit = 0;                                        // flush after every instruction to keep the two in order
+
+    p = renderordered(ctx, out->buf + out->len, renderrangejob, &jobs, count);
+    out->len = p - out->buf;
+    outflush(out);
+    ret = 0;
+
+done:
+    for(i=0;i<extentcount;i++)
+        free(extents[i].buf);
+    free(extents);
+    free(order);
+    free(jobs.instrptrs);
+    return ret;
+}
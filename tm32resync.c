@@ -0,0 +1,123 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com>
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#if defined(__MINGW32__)
+#include "windows/byteswap.h"
+#else
+#include <byteswap.h>
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "tm32dis.h"
+
+
+// Once a linear sweep decodes an illegal operation, it is reading data, or reading code out of step,
+// and the format field chain it follows from there is meaningless. With --resync, the sweep looks
+// ahead for the most likely place that code starts again, and lists the bytes up to it as data.
+// Every byte in a window after the bad instruction is tried as the start of a decision tree, which
+// is where code is entered, and is scored by how many instructions then decode cleanly, with extra
+// for a chain that runs into another decision tree. Data decodes cleanly more often than might be
+// expected, so a candidate at a 64 byte boundary, where the toolchain aligns its text, is preferred
+// to any other. The best candidate in the window wins, the earliest on a tie.
+
+#define RESYNCWINDOW    256                             //   bytes searched at a time for a place to restart
+#define RESYNCDEPTH     16                              //   instructions decoded to score each candidate
+#define RESYNCMINCLEAN  4                               //   fewest clean instructions for a candidate to be taken
+#define RESYNCALIGN     64                              //   the alignment of text by the toolchain
+#define TREEBONUS       4                               //   score, in clean instructions, of reaching another decision tree
+#define ALIGNBONUS      (RESYNCDEPTH + TREEBONUS)       //   score of being aligned, more than any unaligned candidate
+#define DATAROWBYTES    16                              //   bytes on each line of skipped data
+
+// scorecandidate() scores the instruction stream at start, up to end, as the start of a decision tree.
+// base is the address of objbuf. returns the score, or -1 if too few instructions decode cleanly
+static int32_t scorecandidate(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t start, uint64_t end, uint64_t base) {
+    struct TM32INSTR ins;
+    uint64_t pos = start;
+    uint16_t formatfield = bswap_16(BRTARGETFORMATBYTES);
+    uint32_t clean = 0, tree = FALSE;
+    int32_t score;
+
+    while(clean < RESYNCDEPTH && pos < end) {
+        decodeinstruction(ctx, objbuf + pos, formatfield, base + pos, &ins);
+        if(!instructionclean(&ins))
+            break;
+        clean++;
+        pos += ins.length;
+        formatfield = ins.nextformatfield;
+        if(bswap_16(formatfield) == BRTARGETFORMATBYTES)           // the next instruction is uncompressed
+            tree = TRUE;
+    }
+    if(clean < RESYNCMINCLEAN && pos < end)
+        return -1;
+    score = clean + (tree ? TREEBONUS : 0);
+    if((base + start) % RESYNCALIGN == 0)
+        score += ALIGNBONUS;
+    return score;
+}
+
+// resyncsearch() picks where to restart the linear sweep, at start or after it, and before end.
+// base is the address of objbuf. returns the byte index to restart at, or end if there is no code
+uint64_t resyncsearch(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t start, uint64_t end, uint64_t base) {
+    struct TM32CTX quiet = *ctx;
+    uint64_t pos, windowend, best = end;
+    int32_t score, bestscore;
+
+    quiet.tracemask = 0;                                            // the candidates are not traced
+    for(pos=start;pos<end;pos=windowend) {
+        windowend = (end - pos > RESYNCWINDOW) ? pos + RESYNCWINDOW : end;
+        bestscore = -1;
+        for(;pos<windowend;pos++)
+            if((score = scorecandidate(&quiet, objbuf, pos, end, base)) > bestscore) {
+                bestscore = score;
+                best = pos;
+            }
+        if(bestscore >= 0)
+            return best;
+    }
+    return end;
+}
+
+// putskippeddata() writes the count bytes at data, at address offset, which the sweep skipped,
+// as a line giving their extent followed by their bytes in hex. returns a pointer to the end of the text
+uint8_t *putskippeddata(struct OUTBUF *out, uint8_t *p, const uint8_t *data, uint64_t count, uint64_t offset) {
+    uint64_t row, i;
+
+    p = putstr(p, "\n(* 0x");
+    p = puthex(p, offset, 8);
+    p = putstr(p, " .. 0x");
+    p = puthex(p, offset + count - 1, 8);
+    p = putstr(p, " : ");
+    p = putudec(p, count);
+    p = putstr(p, " bytes of data skipped *)\n");
+    for(row=0;row<count;row+=DATAROWBYTES) {
+        p = outsync(out, p);
+        p = putstr(p, "(* 0x");
+        p = puthex(p, offset + row, 8);
+        p = putstr(p, " :");
+        for(i=row;i<count && i<row+DATAROWBYTES;i++) {
+            *p++ = ' ';
+            p = puthex(p, data[i], 2);
+        }
+        p = putstr(p, " *)\n");
+    }
+    return p;
+}
@@ -0,0 +1,464 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com>
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#if defined(__MINGW32__)
+#include "windows/byteswap.h"
+#else
+#include <byteswap.h>
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "tm32dis.h"
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define TM32_HAVE_X86_KERNELS                           // as in tm32memimg.c
+#include <immintrin.h>
+#endif
+
+// Scan mode looks for TM3260 code in a whole flash dump, among other code and data. Every decision
+// tree but the first in a run of code follows an instruction whose format bytes are 0xaa 0x02 (under
+// the 0xff03 mask, as the upper bits of the second byte are opcode bits), so the candidate starts are
+// the offsets one instruction length after each such pair, for each length an instruction can have.
+// The pairs are found with a SIMD search. Each candidate is scored by how many
+// instructions its format field chain decodes into legal operations, and the best one at each pair is
+// taken as code if it decodes for long enough. The chain is then followed, and the pairs it passes
+// are not tried again.
+//
+// The dump is scanned as it is, and transposed as a memory image, in chunks on all the threads. A
+// chain that runs off the end of its chunk is continued afterwards, and joined to the region found
+// in the next chunk where the two meet.
+
+#define SCANCHUNK       (1024 * 1024)                   //   smallest chunk of the dump scanned by one job
+#define SCANCHUNKS      16                              //   chunks to aim for per thread
+#define SCANMININS      64                              //   default fewest instructions in a region reported
+#define TREEMARK0       (BRTARGETFORMATBYTES >> 8)      //   the format bytes before a decision tree
+#define TREEMARK1       (BRTARGETFORMATBYTES & 0xff)    //   with the second masked by TREEMARK1MASK
+#define TREEMARK1MASK   0x03
+
+// struct SCANREGION is a run of instructions that decode cleanly, from the start of a decision tree
+
+struct SCANREGION {
+    uint64_t start;
+    uint64_t end;                                       //   the byte after the last instruction
+    uint64_t instructions;
+    uint64_t trees;
+    uint16_t formatfield;                               //   the format field of the instruction at end
+    uint32_t open;                                      //   TRUE if the chain was cut at the end of the chunk
+};
+
+// struct SCANJOB is one chunk of a view of the dump, and the regions found in it
+
+struct SCANJOB {
+    const uint8_t *buf;                                 //   the view
+    uint64_t bytecount;                                 //   bytes in the view
+    uint64_t start;                                     //   the chunk
+    uint64_t end;
+    uint64_t mininstructions;
+    struct SCANREGION *regions;
+    uint64_t count;
+    uint64_t allocated;
+    uint32_t failed;
+};
+
+static uint8_t inslengths[MAXTM32INSLEN / 8 + 1];       //   the lengths in bytes an instruction can have
+static uint32_t inslengthcount;
+
+// findmarkword() returns the index of the first 0xaa 0x02 pair in buf that starts from pos, before end,
+// or end. A pair that starts at end - 1 is found from the byte after end, so the chunk whose last byte
+// starts a decision tree finds it
+static uint64_t findmarkword(const uint8_t *buf, uint64_t pos, uint64_t end) {
+    const uint8_t *p;
+
+    while(pos < end) {
+        if(!(p = (const uint8_t *) memchr(buf + pos, TREEMARK0, end - pos)))
+            return end;
+        pos = p - buf;
+        if((p[1] & TREEMARK1MASK) == TREEMARK1)
+            return pos;
+        pos++;
+    }
+    return end;
+}
+
+#if defined(TM32_HAVE_X86_KERNELS)
+
+// The SIMD kernels compare a vector, and the same vector one byte on and masked, with the two bytes of the pair.
+// Both read a byte past end, which the padding after every buffer allows
+
+// findmarksse2() finds the pair as findmarkword() does, 16 bytes at a time
+__attribute__((target("sse2")))
+static uint64_t findmarksse2(const uint8_t *buf, uint64_t pos, uint64_t end) {
+    const __m128i m0 = _mm_set1_epi8((char) TREEMARK0), m1 = _mm_set1_epi8((char) TREEMARK1);
+    const __m128i mask1 = _mm_set1_epi8((char) TREEMARK1MASK);
+    __m128i v0, v1;
+    uint32_t mask;
+
+    for(;pos+16<=end;pos+=16) {
+        v0 = _mm_loadu_si128((const __m128i *) (buf + pos));
+        v1 = _mm_loadu_si128((const __m128i *) (buf + pos + 1));
+        v1 = _mm_and_si128(v1, mask1);
+        mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v0, m0), _mm_cmpeq_epi8(v1, m1)));
+        if(mask)
+            return pos + __builtin_ctz(mask);
+    }
+    return findmarkword(buf, pos, end);
+}
+
+// findmarkavx2() finds the pair as findmarkword() does, 32 bytes at a time
+__attribute__((target("avx2")))
+static uint64_t findmarkavx2(const uint8_t *buf, uint64_t pos, uint64_t end) {
+    const __m256i m0 = _mm256_set1_epi8((char) TREEMARK0), m1 = _mm256_set1_epi8((char) TREEMARK1);
+    const __m256i mask1 = _mm256_set1_epi8((char) TREEMARK1MASK);
+    __m256i v0, v1;
+    uint32_t mask;
+
+    for(;pos+32<=end;pos+=32) {
+        v0 = _mm256_loadu_si256((const __m256i *) (buf + pos));
+        v1 = _mm256_loadu_si256((const __m256i *) (buf + pos + 1));
+        v1 = _mm256_and_si256(v1, mask1);
+        mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(v0, m0), _mm256_cmpeq_epi8(v1, m1)));
+        if(mask)
+            return pos + __builtin_ctz(mask);
+    }
+    return findmarkword(buf, pos, end);
+}
+#endif
+
+struct SCANKERNEL {
+    const char *name;
+    uint64_t (*findmark)(const uint8_t *buf, uint64_t pos, uint64_t end);
+    uint32_t (*supported)(void);
+};
+
+static uint32_t scanalways(void) {
+    return TRUE;
+}
+
+#if defined(TM32_HAVE_X86_KERNELS)
+static uint32_t scansse2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2") ? TRUE : FALSE;
+}
+
+static uint32_t scanavx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? TRUE : FALSE;
+}
+#endif
+
+// scankernels[] lists the pair search kernels, fastest first
+static const struct SCANKERNEL scankernels[] = {
+#if defined(TM32_HAVE_X86_KERNELS)
+    { "avx2",   findmarkavx2,   scanavx2 },
+    { "sse2",   findmarksse2,   scansse2 },
+#endif
+    { "word",   findmarkword,   scanalways },
+    { NULL,     NULL,           NULL }
+};
+
+static const struct SCANKERNEL *scankernel = NULL;
+
+// initscan() selects the fastest pair search kernel that the host cpu supports, and lists the
+// instruction lengths there are
+static void initscan(void) {
+    const struct SCANKERNEL *k;
+    uint32_t f, length;
+
+    if(scankernel)
+        return;
+    for(k=scankernels; !k->supported(); k++)
+        ;
+    for(length=1;length<=MAXTM32INSLEN/8;length++)
+        for(f=0;f<FORMATDESCCOUNT;f++)
+            if(formatdescs[f].inslength / 8 == length) {
+                inslengths[inslengthcount++] = length;
+                break;
+            }
+    scankernel = k;
+}
+
+// walkclean() follows the format field chain from pos, with the format field *formatfield, for as long
+// as the instructions decode cleanly and until the first instruction that starts at or after limit,
+// adding the instructions and decision trees it passes to region. At least one instruction is tried.
+// Most candidates fail on their first few operations, so each is checked as soon as it is decoded.
+// returns the byte index where the walk stopped, with *formatfield the format field there
+static uint64_t walkclean(struct TM32CTX *ctx, const struct SCANJOB *job, uint64_t pos, uint64_t limit, uint16_t *formatfield, struct SCANREGION *region) {
+    const struct FORMATDESC *fd;
+    uint64_t opbits[MAXSLOT];
+    struct TM32OP op;
+    uint32_t i;
+
+    do {
+        fd = GETFORMATDESC(*formatfield);
+        unpackinstruction(job->buf + pos, *formatfield, opbits);
+        for(i=0;i<MAXSLOT;i++) {
+            decodeoperation(ctx, fd->opsize[i], opbits[i], &op);
+            if(op.form == FORM_ILLEGAL || op.form == FORM_BADSIZE)
+                return pos;
+        }
+        region->instructions++;
+        region->trees += (fd->inslength == MAXTM32INSLEN);
+        memcpy(formatfield, job->buf + pos, 2);                     // format field for the next instruction
+        pos += fd->inslength / 8;
+    } while(pos < limit && pos < job->bytecount);
+    return pos;
+}
+
+static int32_t addregion(struct SCANJOB *job, const struct SCANREGION *region) {
+    struct SCANREGION *regions;
+
+    if(job->count == job->allocated) {
+        job->allocated = job->allocated ? job->allocated * 2 : 64;
+        if(!(regions = (struct SCANREGION *) realloc(job->regions, job->allocated * sizeof(struct SCANREGION))))
+            return -1;
+        job->regions = regions;
+    }
+    job->regions[job->count++] = *region;
+    return 0;
+}
+
+// scanchunkjob() finds the regions of code in one chunk. It is a job for renderordered(), and
+// renders no text. returns p
+static uint8_t *scanchunkjob(struct TM32CTX *ctx, struct OUTBUF *out, uint8_t *p, void *jobs, uint64_t index) {
+    struct SCANJOB *job = &((struct SCANJOB *) jobs)[index];
+    struct SCANREGION region, best;
+    uint64_t mark, candidate, covered = job->start, stop;
+    uint16_t formatfield;
+    uint32_t i;
+
+    for(mark=job->start;(mark=scankernel->findmark(job->buf, mark, job->end))<job->end;mark++) {
+        if(mark < covered)                                          // inside a region already found
+            continue;
+        memset(&best, 0, sizeof(best));
+        for(i=0;i<inslengthcount;i++) {
+            candidate = mark + inslengths[i];
+            if(candidate >= job->bytecount)
+                break;
+            memset(&region, 0, sizeof(region));
+            formatfield = bswap_16(BRTARGETFORMATBYTES);
+            stop = walkclean(ctx, job, candidate, job->end, &formatfield, &region);
+            if(region.instructions > best.instructions) {
+                best = region;
+                best.start = candidate;
+                best.end = stop;
+                best.formatfield = formatfield;
+                best.open = (stop >= job->end && stop < job->bytecount);
+            }
+        }
+        if(best.instructions && (best.open || best.instructions >= job->mininstructions)) {
+            if(addregion(job, &best) < 0) {
+                job->failed = TRUE;
+                break;
+            }
+            covered = best.end;
+        }
+    }
+    return p;
+}
+
+// joinregions() continues each open region of the count in regions, in order, on along its chain
+// to the region after it, and joins the two where they meet. The regions of at least mininstructions
+// are then compacted to the front of regions. view is any job of the view. returns their count
+static uint64_t joinregions(struct TM32CTX *ctx, const struct SCANJOB *view, struct SCANREGION *regions, uint64_t count, uint64_t mininstructions) {
+    struct SCANREGION *cur = NULL, *r, gap;
+    uint64_t i, kept = 0, pos;
+
+    for(i=0;i<count;i++) {
+        r = &regions[i];
+        if(cur && cur->open) {                                      // follow the chain on to this region
+            memset(&gap, 0, sizeof(gap));
+            pos = (cur->end < r->start) ? walkclean(ctx, view, cur->end, r->start, &cur->formatfield, &gap) : cur->end;
+            cur->instructions += gap.instructions;
+            cur->trees += gap.trees;
+            cur->end = pos;
+            cur->open = FALSE;
+            if(pos == r->start) {                                   // the two are one chain
+                cur->instructions += r->instructions;
+                cur->trees += r->trees;
+                cur->end = r->end;
+                cur->formatfield = r->formatfield;
+                cur->open = r->open;
+                continue;
+            }
+        }
+        if(cur && cur->instructions >= mininstructions)
+            kept++;
+        cur = &regions[kept];                                       // kept is never past i
+        *cur = *r;
+    }
+    if(cur && cur->open) {                                          // the last chunk ends at the end of the view
+        memset(&gap, 0, sizeof(gap));
+        cur->end = walkclean(ctx, view, cur->end, view->bytecount, &cur->formatfield, &gap);
+        cur->instructions += gap.instructions;
+        cur->trees += gap.trees;
+    }
+    if(cur && cur->instructions >= mininstructions)
+        kept++;
+    return kept;
+}
+
+// scanview() scans the bytecount bytes of buf, one view of the dump, on the threads of ctx, for
+// regions of at least mininstructions, which it returns in *regionsp.
+// returns their count, or -1 on error (which is reported)
+static int64_t scanview(struct TM32CTX *ctx, const uint8_t *buf, uint64_t bytecount, uint64_t mininstructions, struct SCANREGION **regionsp) {
+    struct SCANJOB *jobs;
+    struct SCANREGION *regions = NULL;
+    uint64_t chunk, count, j, total = 0;
+    int64_t ret = -1;
+
+    chunk = bytecount / ((uint64_t) ctx->threads * SCANCHUNKS) + 1;
+    if(chunk < SCANCHUNK)
+        chunk = SCANCHUNK;
+    count = (bytecount + chunk - 1) / chunk;
+    if(!count)
+        count = 1;
+    if(!(jobs = (struct SCANJOB *) calloc(count, sizeof(struct SCANJOB)))) {
+        fprintf(stderr, "Could not malloc space for %" PRIu64 " scan jobs\n", count);
+        return -1;
+    }
+    for(j=0;j<count;j++) {
+        jobs[j].buf = buf;
+        jobs[j].bytecount = bytecount;
+        jobs[j].start = j * chunk;
+        jobs[j].end = (j == count - 1) ? bytecount : (j + 1) * chunk;
+        jobs[j].mininstructions = mininstructions;
+    }
+
+    renderordered(ctx, ctx->out.buf + ctx->out.len, scanchunkjob, jobs, count);     // the jobs render no text
+
+    for(j=0;j<count;j++) {
+        if(jobs[j].failed)
+            goto nomemory;
+        total += jobs[j].count;
+    }
+    if(total && !(regions = (struct SCANREGION *) malloc(total * sizeof(struct SCANREGION))))
+        goto nomemory;
+    for(j=0, total=0;j<count;j++) {                                 // in order of the chunks, so in order of start
+        memcpy(regions + total, jobs[j].regions, jobs[j].count * sizeof(struct SCANREGION));
+        total += jobs[j].count;
+    }
+    *regionsp = regions;
+    ret = joinregions(ctx, &jobs[0], regions, total, mininstructions);
+    goto done;
+
+nomemory:
+    fprintf(stderr, "Could not malloc space for the regions found\n");
+done:
+    for(j=0;j<count;j++)
+        free(jobs[j].regions);
+    free(jobs);
+    return ret;
+}
+
+// putregions() prints the count regions of a view
+static void putregions(const char *view, const struct SCANREGION *regions, uint64_t count, uint64_t skip) {
+    uint64_t i;
+
+    for(i=0;i<count;i++)
+        fprintf(stdout, "%-8s 0x%08" PRIx64 "  0x%08" PRIx64 "  %12" PRIu64 "  %12" PRIu64 "  %8" PRIu64 "\n", view,
+                skip + regions[i].start, skip + regions[i].end, regions[i].end - regions[i].start,
+                regions[i].instructions, regions[i].trees);
+}
+
+// tmscan() scans the bytecount bytes at objbuf, which start at byte skip of the file, for regions
+// of code of at least mininstructions instructions, as they are and as a memory image, and prints them.
+// returns 0 on success, -1 on error (which is reported)
+
+int32_t tmscan(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t bytecount, uint64_t skip, uint64_t mininstructions) {
+
+    struct SCANREGION *plain = NULL, *memimg = NULL;
+    uint8_t *membuf = NULL;
+    int64_t plaincount, memimgcount;
+    int32_t ret = -1;
+
+    initscan();
+    if(!mininstructions)
+        mininstructions = SCANMININS;
+    fprintf(stdout, "Looking for code of at least %" PRIu64 " instructions, as is and as a memory image, on %u threads\n",
+            mininstructions, ctx->threads);
+
+    if((plaincount = scanview(ctx, objbuf, bytecount, mininstructions, &plain)) < 0)
+        goto done;
+
+    if(!(membuf = (uint8_t *) calloc(MEMIMGBYTES(bytecount) + OBJPADDING, 1))) {
+        fprintf(stderr, "Could not malloc %" PRId64 " bytes working space in big-endian buffer\n", bytecount);
+        goto done;
+    }
+    extractmemimginstructions(ctx, objbuf, membuf, MEMIMGBYTES(bytecount));
+    if((memimgcount = scanview(ctx, membuf, bytecount, mininstructions, &memimg)) < 0)
+        goto done;
+
+    fprintf(stdout, "\n%-8s %-10s  %-10s  %12s  %12s  %8s\n", "view", "start", "end", "bytes", "instructions", "trees");
+    putregions("plain", plain, plaincount, skip);
+    putregions("memimg", memimg, memimgcount, skip);
+    fprintf(stdout, "\n%" PRId64 " regions found as is, %" PRId64 " as a memory image\n", plaincount, memimgcount);
+    if(memimgcount)
+        fprintf(stdout, "Memory image offsets are in the transposed stream, so a region that does not start on a\n"
+                        "32 byte block is best disassembled with -m and --resync, or with an index\n");
+    ret = 0;
+
+done:
+    free(plain);
+    free(memimg);
+    free(membuf);
+    return ret;
+}
+
+// checkscankernels() compares the pair search of each kernel that the host supports against the
+// word kernel, from every start, over random data with pairs put in at the edges of the vectors.
+// returns the count of kernels that disagree
+
+uint32_t checkscankernels(void) {
+    const struct SCANKERNEL *k;
+    uint8_t *buf;
+    uint32_t i, count = 4096 + 17, errors = 0, bad;
+    uint64_t pos;
+
+    initscan();
+    if(!(buf = (uint8_t *) calloc(count + OBJPADDING, 1)))
+        return 1;
+    srand(0xaa02);
+    for(i=0;i<count;i++)
+        buf[i] = (rand() & 1) ? TREEMARK0 : (uint8_t) (rand() >> 4);
+    for(i=15;i+1<count;i+=97) {                                     // across 16 and 32 byte vectors
+        buf[i] = TREEMARK0;
+        buf[i + 1] = TREEMARK1 | (uint8_t) (rand() & ~TREEMARK1MASK);
+    }
+    buf[count - 1] = TREEMARK0;                                     // a pair cut by the end is found, from
+    buf[count] = TREEMARK1;                                         // the byte past end
+
+    for(k=scankernels; k->name; k++) {
+        if(!k->supported()) {
+            fprintf(stdout, "scan kernel %-7s : not supported by this cpu\n", k->name);
+            continue;
+        }
+        for(pos=0, bad=FALSE;pos<count && !bad;pos++)
+            bad = (k->findmark(buf, pos, count) != findmarkword(buf, pos, count));
+        bad |= (k->findmark(buf, count - 1, count) != count - 1);
+        fprintf(stdout, "scan kernel %-7s : %s\n", k->name, bad ? "FAILED" : "ok");
+        errors += bad;
+    }
+    free(buf);
+    return errors;
+}
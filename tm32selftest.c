@@ -0,0 +1,57 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com> 
+//     
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "tm32dis.h"
+#include "tm32disinstrs.h"
+
+
+// selftest() cross-checks the precomputed decode tables and fast paths against the
+// straightforward reference routines they replace.
+// returns 0 if every check passes, -1 otherwise
+
+int32_t selftest(void) {
+    uint32_t errors, failed = 0;
+
+    tm32init();
+
+    errors = checkopcodetable();
+    fprintf(stdout, "opcode table        : %s (%d mismatches)\n", errors ? "FAILED" : "ok", errors);
+    failed += errors;
+
+    errors = checkdecodetable();
+    fprintf(stdout, "decode table        : %s (%d operations differ)\n", errors ? "FAILED" : "ok", errors);
+    failed += errors;
+
+    errors = checkunpack();
+    fprintf(stdout, "batch unpack        : %s (%d operations differ)\n", errors ? "FAILED" : "ok", errors);
+    failed += errors;
+
+    errors = checkmemimgkernels();
+    fprintf(stdout, "memimg transposition: %s (%d kernels disagree)\n", errors ? "FAILED" : "ok", errors);
+    failed += errors;
+
+    errors = checkscankernels();
+    fprintf(stdout, "scan pair search    : %s (%d kernels disagree)\n", errors ? "FAILED" : "ok", errors);
+    failed += errors;
+
+    return failed ? -1 : 0;
+}
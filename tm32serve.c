@@ -0,0 +1,728 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com>
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined(__MINGW32__)
+#define _DEFAULT_SOURCE                             // for sockets, signals and pthreads under -std=c99
+#define _BSD_SOURCE
+#endif
+#if defined(__MINGW32__)
+#include "windows/byteswap.h"
+#else
+#include <byteswap.h>
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#if defined(TM32_HAVE_PTHREAD)
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#endif
+#include "tm32dis.h"
+
+
+// Server mode keeps object files loaded (and memory images transposed) between requests, and
+// answers them over a Unix socket, so that a client making many small requests pays neither the
+// start-up nor the load of a run each time. Each request is one line:
+//
+//   <image> <address> <count> [<format>]
+//
+// for count bytes (0 for the rest of the image) from address, where the address is the byte in the
+// image plus the -a adjustment, as a disassembly shows it, and format is 0, 1, json or bin as -f
+// (default the -f of the server). The reply is a line "ok <n>" then the n bytes of the disassembly,
+// exactly as a run with -s, -c and -a would write it, or a line "error <message>".
+//
+// The rendered text is kept in an LRU cache of chunks, each a decision tree (or SERVECHUNKMAX
+// instructions of one), keyed by the state of the decoder at its start. A request is answered from
+// the chunks that cover it, and only the chunks not already cached are decoded.
+//
+// Each request checks that its file still has the length, modification time and inode it was loaded
+// with. A file that has changed is loaded again, and the chunks of the old one are dropped; the old
+// mapping is kept until the requests still decoding from it are done.
+
+#define SERVEIMAGES         64                          //   most images kept loaded
+#define SERVECONNS          1024                        //   most connections open at once
+#define SERVELINE           4096                        //   longest request line
+#define SERVECHUNKMAX       256                         //   most instructions in a chunk
+#define SERVECACHEBYTES     (256 * 1024 * 1024)         //   most bytes held by the chunk cache
+#define SERVEBUCKETS        65536                       //   hash buckets of the chunk cache, a power of 2
+
+#if defined(TM32_HAVE_PTHREAD)
+
+// struct SERVEIMAGE is an object file held loaded, by the name it was requested by
+
+struct SERVEIMAGE {
+    char *name;
+    uint32_t id;                                        //   the key of its chunks, not used again once it is reloaded
+    uint32_t refs;                                      //   requests using it, and one while it is the one loaded
+    struct OBJIMAGE img;
+    struct OBJIMAGE cached;                             //   its transposed bytes from the --cache-dir, if used
+    uint8_t *objbuf;
+    uint64_t length;
+};
+
+// struct SERVECHUNK is the text of a run of instructions in one format. The key is the state of the
+// decoder at the first of them. The ends of each instruction, in bytes and in text, are kept so
+// that a request that ends within the chunk can take just the instructions it covers
+
+struct SERVECHUNK {
+    uint32_t image;                                     //   key: id of the image
+    uint32_t format;
+    uint64_t pos;                                       //   byte index of the first instruction
+    uint16_t formatfield;
+    uint32_t insnum;
+    uint64_t end;                                       //   byte index after the last instruction
+    uint16_t nextformatfield;                           //   the state of the decoder there
+    uint32_t nextinsnum;
+    uint32_t count;
+    uint32_t posends[SERVECHUNKMAX];                    //   from pos
+    uint32_t textends[SERVECHUNKMAX];
+    uint8_t *text;
+    size_t size;
+    struct SERVECHUNK *hashnext;
+    struct SERVECHUNK *newer, *older;                   //   the LRU list
+};
+
+// struct SERVETEXT is the text of one reply, as it is gathered
+
+struct SERVETEXT {
+    uint8_t *text;
+    size_t len;
+    size_t size;
+};
+
+// struct SERVECONN is an open connection, with the start of any request line not yet complete
+
+struct SERVECONN {
+    int32_t fd;
+    char line[SERVELINE];
+    size_t len;
+    struct SERVETEXT reply;
+    struct SERVECONN *next;                             //   in the list it is on
+};
+
+struct TM32SERVER {
+    struct TM32CTX *ctx;
+    uint32_t memoryimage;
+    uint64_t offset;
+    const char *cachedir;
+
+    pthread_mutex_t imagelock;                          //   held while an image is looked up, not while it is loaded
+    struct SERVEIMAGE *images[SERVEIMAGES];             //   the one loaded for each name requested
+    uint32_t imagecount;
+    uint32_t nextid;
+
+    pthread_mutex_t cachelock;
+    struct SERVECHUNK **buckets;
+    struct SERVECHUNK *newest, *oldest;
+    uint64_t cachebytes;
+
+    pthread_mutex_t queuelock;                          //   held while a connection changes hands
+    pthread_cond_t queued;
+    struct SERVECONN *ready, *readytail;                //   connections with something to read, for the workers
+    struct SERVECONN *returned;                         //   connections the workers have finished with, for now
+    uint32_t conncount;
+    int32_t wakefds[2];                                 //   a pipe that wakes the main thread as they are returned
+};
+
+static const char *servesocketname = NULL;
+
+// stopserving() removes the socket when the server is told to stop
+static void stopserving(int signum) {
+    if(servesocketname)
+        unlink(servesocketname);
+    _exit(0);
+}
+
+// reservetext() makes room for len more bytes in t. returns 0 on success, -1 if out of memory
+static int32_t reservetext(struct SERVETEXT *t, size_t len) {
+    uint8_t *text;
+    size_t size;
+
+    if(t->len + len <= t->size)
+        return 0;
+    for(size = t->size ? t->size : OUTBUFSIZE; size < t->len + len; size *= 2)
+        ;
+    if(!(text = (uint8_t *) realloc(t->text, size)))
+        return -1;
+    t->text = text;
+    t->size = size;
+    return 0;
+}
+
+static int32_t appendtext(struct SERVETEXT *t, const uint8_t *buf, size_t len) {
+    if(reservetext(t, len) < 0)
+        return -1;
+    memcpy(t->text + t->len, buf, len);
+    t->len += len;
+    return 0;
+}
+
+static uint32_t chunkbucket(uint32_t image, uint32_t format, uint64_t pos, uint16_t formatfield, uint32_t insnum) {
+    uint64_t h = (pos * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t) formatfield << 32) ^ ((uint64_t) image << 48) ^ ((uint64_t) format << 56) ^ insnum;
+
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return (uint32_t) (h >> 32) & (SERVEBUCKETS - 1);
+}
+
+// unlinkchunk() takes chunk c off the LRU list of srv
+static void unlinkchunk(struct TM32SERVER *srv, struct SERVECHUNK *c) {
+    if(c->newer)
+        c->newer->older = c->older;
+    else
+        srv->newest = c->older;
+    if(c->older)
+        c->older->newer = c->newer;
+    else
+        srv->oldest = c->newer;
+}
+
+static void pushchunk(struct TM32SERVER *srv, struct SERVECHUNK *c) {
+    c->newer = NULL;
+    c->older = srv->newest;
+    if(srv->newest)
+        srv->newest->newer = c;
+    else
+        srv->oldest = c;
+    srv->newest = c;
+}
+
+static void freechunk(struct SERVECHUNK *c) {
+    free(c->text);
+    free(c);
+}
+
+// removechunk() takes chunk c out of the cache of srv, and frees it
+static void removechunk(struct TM32SERVER *srv, struct SERVECHUNK *c) {
+    struct SERVECHUNK **pp;
+
+    unlinkchunk(srv, c);
+    for(pp=&srv->buckets[chunkbucket(c->image, c->format, c->pos, c->formatfield, c->insnum)]; *pp!=c; pp=&(*pp)->hashnext)
+        ;
+    *pp = c->hashnext;
+    srv->cachebytes -= sizeof(struct SERVECHUNK) + c->size;
+    freechunk(c);
+}
+
+// dropimagechunks() frees the cached chunks of the image with id image
+static void dropimagechunks(struct TM32SERVER *srv, uint32_t image) {
+    struct SERVECHUNK *c, *older;
+
+    pthread_mutex_lock(&srv->cachelock);
+    for(c=srv->newest; c; c=older) {
+        older = c->older;
+        if(c->image == image)
+            removechunk(srv, c);
+    }
+    pthread_mutex_unlock(&srv->cachelock);
+}
+
+// findchunk() returns the cached chunk with the key given, made the most recently used, or NULL.
+// The cache lock must be held
+static struct SERVECHUNK *findchunk(struct TM32SERVER *srv, uint32_t image, uint32_t format, uint64_t pos, uint16_t formatfield, uint32_t insnum) {
+    struct SERVECHUNK *c;
+
+    for(c=srv->buckets[chunkbucket(image, format, pos, formatfield, insnum)]; c; c=c->hashnext)
+        if(c->pos == pos && c->formatfield == formatfield && c->insnum == insnum && c->image == image && c->format == format) {
+            unlinkchunk(srv, c);
+            pushchunk(srv, c);
+            return c;
+        }
+    return NULL;
+}
+
+// addchunk() adds the chunk c to the cache, making room for it. If another thread has added the same
+// chunk in the meantime, c is freed and that one is returned. The cache lock must be held
+static struct SERVECHUNK *addchunk(struct TM32SERVER *srv, struct SERVECHUNK *c) {
+    struct SERVECHUNK *found;
+    uint32_t bucket = chunkbucket(c->image, c->format, c->pos, c->formatfield, c->insnum);
+
+    if((found = findchunk(srv, c->image, c->format, c->pos, c->formatfield, c->insnum))) {
+        freechunk(c);
+        return found;
+    }
+    while(srv->oldest && srv->cachebytes + sizeof(struct SERVECHUNK) + c->size > SERVECACHEBYTES)
+        removechunk(srv, srv->oldest);                              // the least recently used
+    c->hashnext = srv->buckets[bucket];
+    srv->buckets[bucket] = c;
+    pushchunk(srv, c);
+    srv->cachebytes += sizeof(struct SERVECHUNK) + c->size;
+    return c;
+}
+
+// loadimage() opens the object file name, and transposes it if the server takes memory images. It is
+// called without the image lock, so that a large file holds up only the requests for it.
+// returns the image, with no references yet, or NULL if it cannot be loaded, with the reason in err
+static struct SERVEIMAGE *loadimage(struct TM32SERVER *srv, const char *name, const char **err) {
+    struct SERVEIMAGE *im;
+
+    *err = "out of memory";
+    if(!(im = (struct SERVEIMAGE *) calloc(1, sizeof(struct SERVEIMAGE))))
+        return NULL;
+    im->cached.fd = -1;
+    *err = "could not open the image";
+    if(openobjfile(name, &im->img) < 0) {
+        free(im);
+        return NULL;
+    }
+    im->length = im->img.filelength;
+    *err = "could not read the image";
+    if(srv->memoryimage && srv->cachedir)
+        im->objbuf = cachedmemimg(srv->ctx, srv->cachedir, &im->img, 0, &im->cached);
+    else
+        im->objbuf = mapobjwindow(&im->img, 0, im->length, srv->memoryimage);
+    if(!im->objbuf || !(im->name = strdup(name))) {
+        closeobjfile(&im->img);
+        closeobjfile(&im->cached);
+        free(im);
+        return NULL;
+    }
+    if(srv->memoryimage && !srv->cachedir)
+        extractmemimginplace(srv->ctx, im->objbuf, MEMIMGBYTES(im->length));
+    return im;
+}
+
+static void freeimage(struct SERVEIMAGE *im) {
+    closeobjfile(&im->img);
+    closeobjfile(&im->cached);
+    free(im->name);
+    free(im);
+}
+
+// releaseimage() drops a reference to the image im, and frees it once it has none
+static void releaseimage(struct TM32SERVER *srv, struct SERVEIMAGE *im) {
+    uint32_t refs;
+
+    pthread_mutex_lock(&srv->imagelock);
+    refs = --im->refs;
+    pthread_mutex_unlock(&srv->imagelock);
+    if(!refs)
+        freeimage(im);
+}
+
+// findimage() returns the image name, with a reference held for the caller to release. It is loaded
+// if it is not yet loaded, or again if the file has changed since.
+// returns NULL if it cannot be loaded, with the reason in err
+static struct SERVEIMAGE *findimage(struct TM32SERVER *srv, const char *name, const char **err) {
+    struct SERVEIMAGE *im = NULL, *loaded, *old = NULL, *discard = NULL;
+    uint32_t i, full;
+
+    pthread_mutex_lock(&srv->imagelock);
+    for(i=0;i<srv->imagecount;i++)
+        if(!strcmp(srv->images[i]->name, name)) {
+            im = srv->images[i];
+            im->refs++;
+            break;
+        }
+    full = (srv->imagecount == SERVEIMAGES);
+    pthread_mutex_unlock(&srv->imagelock);
+    if(im && !objfilechanged(name, &im->img))
+        return im;
+    *err = "too many images";
+    if(!im && full)
+        return NULL;
+
+    if((loaded = loadimage(srv, name, err))) {                      // without the lock
+        pthread_mutex_lock(&srv->imagelock);
+        for(i=0;i<srv->imagecount && strcmp(srv->images[i]->name, name);i++)
+            ;
+        if(i < srv->imagecount && srv->images[i] != im) {           // another request has loaded it meanwhile
+            discard = loaded;
+            loaded = srv->images[i];
+            loaded->refs++;
+        } else if(i == SERVEIMAGES) {
+            *err = "too many images";
+            discard = loaded;
+            loaded = NULL;
+        } else {
+            loaded->id = srv->nextid++;
+            loaded->refs = 2;                                       // the caller's, and the table's
+            if(i == srv->imagecount)
+                srv->imagecount++;
+            else
+                old = srv->images[i];
+            srv->images[i] = loaded;
+            fprintf(stdout, "%s %" PRId64 " (0x%" PRIx64 ") bytes from file '%s'\n", old ? "Reloaded" : "Loaded",
+                    loaded->length, loaded->length, name);
+            fflush(stdout);
+        }
+        pthread_mutex_unlock(&srv->imagelock);
+    }
+
+    if(discard)
+        freeimage(discard);
+    if(old) {                                                       // its chunks are never asked for again
+        dropimagechunks(srv, old->id);
+        releaseimage(srv, old);                                     // the table's reference
+    }
+    if(im)
+        releaseimage(srv, im);                                      // and the one taken above
+    return loaded;
+}
+
+// buildchunk() decodes and renders the instructions of image im from byte pos, with the decoder in the
+// state given, up to the next decision tree, SERVECHUNKMAX instructions, or the end of the image.
+// returns the chunk, or NULL if out of memory
+static struct SERVECHUNK *buildchunk(struct TM32SERVER *srv, const struct SERVEIMAGE *im, uint32_t format, uint64_t pos, uint16_t formatfield, uint32_t insnum) {
+    struct SERVECHUNK *c;
+    struct TM32INSTR ins;
+    uint64_t start = pos;
+    size_t len = 0;
+    uint8_t *text;
+
+    if(!(c = (struct SERVECHUNK *) calloc(1, sizeof(struct SERVECHUNK))))
+        return NULL;
+    c->image = im->id;
+    c->format = format;
+    c->pos = pos;
+    c->formatfield = formatfield;
+    c->insnum = insnum;
+
+    while(pos < im->length && c->count < SERVECHUNKMAX) {
+        if(c->count && GETFORMATDESC(formatfield)->inslength == MAXTM32INSLEN)
+            break;                                                  // the next decision tree starts a chunk of its own
+        if(c->size - len < OUTRESERVE) {
+            if(!(text = (uint8_t *) realloc(c->text, c->size + 16 * OUTRESERVE))) {
+                freechunk(c);
+                return NULL;
+            }
+            c->text = text;
+            c->size += 16 * OUTRESERVE;
+        }
+        decodeinstruction(srv->ctx, im->objbuf + pos, formatfield, srv->offset + pos, &ins);
+        insnum = (ins.length * 8 == MAXTM32INSLEN) ? 0 : insnum + 1;
+        len = renderinstruction(c->text + len, format, &ins, im->objbuf + pos, insnum) - c->text;
+        pos += ins.length;
+        formatfield = ins.nextformatfield;
+        c->posends[c->count] = pos - start;
+        c->textends[c->count] = len;
+        c->count++;
+    }
+    c->end = pos;
+    c->nextformatfield = formatfield;
+    c->nextinsnum = insnum;
+    return c;
+}
+
+// servewindow() appends the disassembly of count bytes of image im from byte skip, in format, to t.
+// returns 0 on success, -1 if out of memory
+static int32_t servewindow(struct TM32SERVER *srv, struct SERVETEXT *t, const struct SERVEIMAGE *im, uint32_t format, uint64_t skip, uint64_t count) {
+    struct TM32CTX fmt = *srv->ctx;
+    struct SERVECHUNK *c, *built;
+    uint16_t formatfield = bswap_16(BRTARGETFORMATBYTES);
+    uint64_t pos = skip, end = skip + count;
+    uint32_t insnum = 0, n;
+    uint8_t lines[64];
+
+    fmt.printoutformat = format;
+    if(format == OUTFORMAT_BIN && appendtext(t, lines, putbinheader(lines) - lines) < 0)
+        return -1;
+    if(appendtext(t, lines, putdisassemblystart(&fmt, lines) - lines) < 0)
+        return -1;
+
+    while(pos < end) {
+        if(GETFORMATDESC(formatfield)->inslength == MAXTM32INSLEN)
+            insnum = 0;                                             // the same chunk, whatever the tree before it
+
+        pthread_mutex_lock(&srv->cachelock);
+        if(!(c = findchunk(srv, im->id, format, pos, formatfield, insnum))) {
+            pthread_mutex_unlock(&srv->cachelock);                  // decode it without holding up the other workers
+            if(!(built = buildchunk(srv, im, format, pos, formatfield, insnum)))
+                return -1;
+            pthread_mutex_lock(&srv->cachelock);
+            c = addchunk(srv, built);
+        }
+        if(c->end <= end)                                           // the text is copied while the chunk cannot be evicted
+            n = c->count;
+        else
+            for(n=0; n==0 || c->pos + c->posends[n-1] < end; n++)   // the instructions that start within the window
+                ;
+        if(appendtext(t, c->text, c->textends[n-1]) < 0) {
+            pthread_mutex_unlock(&srv->cachelock);
+            return -1;
+        }
+        pos = c->end;
+        formatfield = c->nextformatfield;
+        insnum = c->nextinsnum;
+        pthread_mutex_unlock(&srv->cachelock);
+    }
+    return appendtext(t, lines, putdisassemblyend(&fmt, lines) - lines);
+}
+
+// writeall() writes len bytes at buf to the socket fd. returns 0 on success, -1 on error
+static int32_t writeall(int32_t fd, const uint8_t *buf, size_t len) {
+    ssize_t n;
+
+    while(len > 0) {
+        if((n = write(fd, buf, len)) <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int32_t replyerror(int32_t fd, const char *message) {
+    char line[256];
+
+    snprintf(line, sizeof(line), "error %s\n", message);
+    return writeall(fd, (const uint8_t *) line, strlen(line));
+}
+
+// serverequest() answers the request line on the socket fd. returns 0, or -1 if the socket failed
+static int32_t serverequest(struct TM32SERVER *srv, int32_t fd, char *line, struct SERVETEXT *t) {
+    char *name, *s, *end, header[64];
+    uint64_t address, count, skip;
+    uint32_t format = srv->ctx->printoutformat;
+    struct SERVEIMAGE *im;
+    const char *err;
+    int32_t ret;
+
+    if(!(name = strtok_r(line, " \t\r\n", &s)))
+        return 0;                                                   // a blank line has no reply
+    if(!(end = strtok_r(NULL, " \t\r\n", &s)) || (address = strtoull(end, &end, 0), *end) ||
+       !(end = strtok_r(NULL, " \t\r\n", &s)) || (count = strtoull(end, &end, 0), *end))
+        return replyerror(fd, "expected <image> <address> <count> [<format>]");
+    if((end = strtok_r(NULL, " \t\r\n", &s))) {
+        if(!strcmp(end, "json"))
+            format = OUTFORMAT_JSON;
+        else if(!strcmp(end, "bin"))
+            format = OUTFORMAT_BIN;
+        else if(!strcmp(end, "0") || !strcmp(end, "1"))
+            format = strtol(end, NULL, 0);
+        else
+            return replyerror(fd, "unknown format");
+    }
+    if(!(im = findimage(srv, name, &err)))
+        return replyerror(fd, err);
+
+    skip = address - srv->offset;
+    if(address < srv->offset || skip >= im->length) {
+        releaseimage(srv, im);
+        return replyerror(fd, "address outside the image");
+    }
+    if(count == 0 || count > im->length - skip)
+        count = im->length - skip;
+
+    t->len = 0;
+    ret = servewindow(srv, t, im, format, skip, count);
+    releaseimage(srv, im);                                          // the reply is all in t
+    if(ret < 0)
+        return replyerror(fd, "out of memory");
+    snprintf(header, sizeof(header), "ok %" PRIu64 "\n", (uint64_t) t->len);
+    if(writeall(fd, (const uint8_t *) header, strlen(header)) < 0)
+        return -1;
+    return writeall(fd, t->text, t->len);
+}
+
+// serveconnection() reads what the client of connection c has sent, and answers each complete request
+// line in it. The start of a line not yet complete is kept for the next time.
+// returns 0, or -1 if the connection has closed or failed
+static int32_t serveconnection(struct TM32SERVER *srv, struct SERVECONN *c) {
+    char *line, *newline;
+    ssize_t n;
+
+    if((n = read(c->fd, c->line + c->len, SERVELINE - 1 - c->len)) <= 0)
+        return -1;
+    c->len += n;
+    c->line[c->len] = '\0';
+    for(line=c->line; (newline = strchr(line, '\n')); line=newline+1) {
+        *newline = '\0';
+        if(serverequest(srv, c->fd, line, &c->reply) < 0)
+            return -1;
+    }
+    c->len -= line - c->line;
+    memmove(c->line, line, c->len);
+    if(c->len == SERVELINE - 1) {                                   // no room left for the rest of the line
+        c->len = 0;
+        return replyerror(c->fd, "request too long");
+    }
+    return 0;
+}
+
+// serveworker() answers the connections that have something to read, one at a time, and hands each
+// back to the main thread to wait for its next request, or closes it
+static void *serveworker(void *arg) {
+    struct TM32SERVER *srv = (struct TM32SERVER *) arg;
+    struct SERVECONN *c;
+
+    while(TRUE) {
+        pthread_mutex_lock(&srv->queuelock);
+        while(!srv->ready)
+            pthread_cond_wait(&srv->queued, &srv->queuelock);
+        c = srv->ready;
+        if(!(srv->ready = c->next))
+            srv->readytail = NULL;
+        pthread_mutex_unlock(&srv->queuelock);
+
+        if(serveconnection(srv, c) < 0) {
+            close(c->fd);
+            free(c->reply.text);
+            free(c);
+            pthread_mutex_lock(&srv->queuelock);
+            srv->conncount--;
+            pthread_mutex_unlock(&srv->queuelock);
+            continue;
+        }
+        pthread_mutex_lock(&srv->queuelock);
+        c->next = srv->returned;
+        srv->returned = c;
+        pthread_mutex_unlock(&srv->queuelock);
+        if(write(srv->wakefds[1], "", 1) < 0)                       // the main thread polls for it again once woken
+            continue;
+    }
+    return NULL;
+}
+
+// tmserve() answers requests on the Unix socket socketname, on ctx->threads worker threads, until the
+// server is stopped by a signal. Requests may name any object file; each is loaded (and if memoryimage,
+// transposed, through the cache directory cachedir if not NULL) the first time, and then kept until
+// the file changes.
+// The main thread polls the open connections, and passes each that has something to read to the
+// workers, so that a client that keeps its connection open between requests holds no worker.
+// returns -1 if the server could not be started (which is reported)
+
+int32_t tmserve(struct TM32CTX *ctx, const char *socketname, uint32_t memoryimage, uint64_t offset, const char *cachedir) {
+
+    struct TM32SERVER *srv;
+    struct SERVECONN **idle, *c;
+    struct pollfd *fds;
+    struct sockaddr_un addr;
+    struct stat st;
+    pthread_t thread;
+    uint32_t t, started = 0, idlecount = 0, i;
+    int32_t listenfd, fd;
+    char drain[256];
+
+    if(strlen(socketname) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "The socket name '%s' is too long\n", socketname);
+        return -1;
+    }
+    srv = (struct TM32SERVER *) calloc(1, sizeof(struct TM32SERVER));
+    idle = (struct SERVECONN **) malloc(SERVECONNS * sizeof(struct SERVECONN *));
+    fds = (struct pollfd *) malloc((SERVECONNS + 2) * sizeof(struct pollfd));
+    if(!srv || !idle || !fds || !(srv->buckets = (struct SERVECHUNK **) calloc(SERVEBUCKETS, sizeof(struct SERVECHUNK *)))) {
+        fprintf(stderr, "Could not malloc space for the server\n");
+        free(srv);
+        free(idle);
+        free(fds);
+        return -1;
+    }
+    srv->ctx = ctx;
+    srv->memoryimage = memoryimage;
+    srv->offset = offset;
+    srv->cachedir = cachedir;
+    pthread_mutex_init(&srv->imagelock, NULL);
+    pthread_mutex_init(&srv->cachelock, NULL);
+    pthread_mutex_init(&srv->queuelock, NULL);
+    pthread_cond_init(&srv->queued, NULL);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketname);
+    if(lstat(socketname, &st) == 0 && S_ISSOCK(st.st_mode))         // left behind by a server that was killed
+        unlink(socketname);
+    if(pipe(srv->wakefds) < 0 || (listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+       bind(listenfd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listenfd, SOMAXCONN) < 0) {
+        fprintf(stderr, "Could not listen on the socket '%s'\n", socketname);
+        return -1;
+    }
+    servesocketname = socketname;
+    signal(SIGINT, stopserving);
+    signal(SIGTERM, stopserving);
+    signal(SIGPIPE, SIG_IGN);                                       // a client that goes away only ends its connection
+
+    for(t=0;t<ctx->threads;t++)
+        if(pthread_create(&thread, NULL, serveworker, srv) == 0 && pthread_detach(thread) == 0)
+            started++;
+    if(!started) {
+        fprintf(stderr, "Could not start the server threads\n");
+        unlink(socketname);
+        return -1;
+    }
+    fprintf(stdout, "Serving on '%s' with %u threads\n", socketname, started);
+    fflush(stdout);
+
+    while(TRUE) {
+        pthread_mutex_lock(&srv->queuelock);
+        fds[0].fd = (srv->conncount < SERVECONNS) ? listenfd : -1;  // accept no more until some have closed
+        pthread_mutex_unlock(&srv->queuelock);
+        fds[0].events = POLLIN;
+        fds[1].fd = srv->wakefds[0];
+        fds[1].events = POLLIN;
+        for(i=0;i<idlecount;i++) {
+            fds[i+2].fd = idle[i]->fd;
+            fds[i+2].events = POLLIN;
+        }
+        if(poll(fds, idlecount + 2, -1) < 0)
+            continue;
+
+        pthread_mutex_lock(&srv->queuelock);
+        for(i=idlecount;i-->0;)                                     // each ready connection goes to the workers, and the
+            if(fds[i+2].revents) {                                  // last takes its place, as it has been looked at
+                c = idle[i];
+                idle[i] = idle[--idlecount];
+                c->next = NULL;
+                if(srv->readytail)
+                    srv->readytail->next = c;
+                else
+                    srv->ready = c;
+                srv->readytail = c;
+                pthread_cond_signal(&srv->queued);
+            }
+        if(fds[1].revents) {                                        // and the workers have handed some back
+            if(read(srv->wakefds[0], drain, sizeof(drain)) < 0)
+                drain[0] = 0;
+            for(c=srv->returned; c; c=c->next)
+                idle[idlecount++] = c;
+            srv->returned = NULL;
+        }
+        pthread_mutex_unlock(&srv->queuelock);
+
+        if(fds[0].fd >= 0 && fds[0].revents && (fd = accept(listenfd, NULL, NULL)) >= 0) {
+            if(!(c = (struct SERVECONN *) calloc(1, sizeof(struct SERVECONN)))) {
+                close(fd);
+                continue;
+            }
+            c->fd = fd;
+            idle[idlecount++] = c;
+            pthread_mutex_lock(&srv->queuelock);
+            srv->conncount++;
+            pthread_mutex_unlock(&srv->queuelock);
+        }
+    }
+    return 0;
+}
+
+#else
+
+int32_t tmserve(struct TM32CTX *ctx, const char *socketname, uint32_t memoryimage, uint64_t offset, const char *cachedir) {
+    fprintf(stderr, "--serve needs threads and Unix sockets, which this build does not have\n");
+    return -1;
+}
+
+#endif
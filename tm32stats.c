@@ -0,0 +1,246 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com>
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#if defined(__MINGW32__)
+#include "windows/byteswap.h"
+#else
+#include <byteswap.h>
+#endif
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "tm32dis.h"
+#include "tm32disinstrs.h"
+
+
+// Statistics mode decodes the instruction stream just as a disassembly does, but renders no text.
+// It counts the operations by name, the format fields, the empty or nop slots, the operation sizes
+// and the lengths of the instructions and decision trees, and prints a summary as text or JSON.
+
+#define OPLISTSIZE      (sizeof(oplist) / sizeof(oplist[0]))
+#define FORMATS         1024                            //   values of the 10-bit format field
+#define TREEBUCKETS     33                              //   decision tree lengths counted one by one, the last is "or more"
+#define OPCODE_NOP      255
+
+struct TM32STATS {
+    uint64_t instructions;
+    uint64_t bytes;
+    uint64_t illegal;                                   //   operations that did not decode
+    uint64_t trees;
+    uint64_t opcount[OPLISTSIZE];                       //   by index in oplist[]
+    uint64_t formatcount[FORMATS];
+    uint64_t slotnops[MAXSLOT];                         //   slots empty, or holding a nop
+    uint64_t sizecount[4];                              //   empty, 26, 34 and 42 bit operations
+    uint64_t treelengths[TREEBUCKETS];                  //   decision trees by count of instructions
+    uint64_t longesttree;
+};
+
+// struct RANKED is one line of a table of counts, sorted with the largest first
+
+struct RANKED {
+    uint64_t count;
+    uint32_t index;
+};
+
+static int compareranked(const void *a, const void *b) {
+    const struct RANKED *x = (const struct RANKED *) a, *y = (const struct RANKED *) b;
+
+    if(x->count != y->count)
+        return (x->count < y->count) - (x->count > y->count);
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+// rankcounts() fills ranked with the non-zero counts of the n in counts, largest first.
+// returns the count of them
+static uint32_t rankcounts(const uint64_t *counts, uint32_t n, struct RANKED *ranked) {
+    uint32_t i, count = 0;
+
+    for(i=0;i<n;i++)
+        if(counts[i]) {
+            ranked[count].count = counts[i];
+            ranked[count].index = i;
+            count++;
+        }
+    qsort(ranked, count, sizeof(struct RANKED), compareranked);
+    return count;
+}
+
+static void endtree(struct TM32STATS *st, uint64_t length) {
+    if(!length)
+        return;
+    st->treelengths[(length < TREEBUCKETS) ? length - 1 : TREEBUCKETS - 1]++;
+    if(length > st->longesttree)
+        st->longesttree = length;
+}
+
+// gatherstats() decodes the bytecount bytes of instruction stream at objbuf into st
+static void gatherstats(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t bytecount, uint64_t offset, struct TM32STATS *st) {
+    struct TM32INSTR ins;
+    const struct TM32OP *dop;
+    uint16_t formatfield = bswap_16(BRTARGETFORMATBYTES);
+    uint64_t pos = 0, treelength = 0;
+    uint32_t i, format;
+
+    while(pos < bytecount) {
+        decodeinstruction(ctx, objbuf + pos, formatfield, offset + pos, &ins);
+        if(ins.length * 8 == MAXTM32INSLEN) {
+            endtree(st, treelength);
+            treelength = 0;
+            st->trees++;
+        }
+        treelength++;
+
+        format = bswap_16(formatfield) & 0xff03;                    // the ten format bits, as 8 + 2
+        st->formatcount[(format >> 8) | ((format & 3) << 8)]++;
+        for(i=0;i<MAXSLOT;i++) {
+            dop = &ins.op[i];
+            st->sizecount[(dop->size / 8 >= 3 && dop->size / 8 <= 5) ? dop->size / 8 - 2 : 0]++;
+            if(dop->form == FORM_ILLEGAL || dop->form == FORM_BADSIZE)
+                st->illegal++;
+            else if(dop->size)
+                st->opcount[dop->opindex]++;
+            if(dop->size == 0 || oplist[dop->opindex].opcode == OPCODE_NOP)
+                st->slotnops[i]++;
+        }
+        st->instructions++;
+        pos += ins.length;
+        formatfield = ins.nextformatfield;
+    }
+    endtree(st, treelength);
+    st->bytes = pos;
+}
+
+// putformat() renders printf style text of at most a line or two at p, in the output buffer out,
+// after making room for it. returns a pointer to the end of the text
+static uint8_t *putformat(struct OUTBUF *out, uint8_t *p, const char *format, ...) {
+    va_list args;
+
+    p = outsync(out, p);
+    va_start(args, format);
+    p += vsnprintf((char *) p, OUTRESERVE, format, args);
+    va_end(args);
+    return p;
+}
+
+// putstatstext() and putstatsjson() render the statistics in st at p, in the output buffer out.
+// return a pointer to the end of the text
+static uint8_t *putstatstext(struct OUTBUF *out, uint8_t *p, const struct TM32STATS *st, const struct RANKED *ops, uint32_t opcount, const struct RANKED *formats, uint32_t formatcount) {
+    static const char *sizenames[4] = { "empty", "26 bit", "34 bit", "42 bit" };
+    uint64_t slots = st->instructions * MAXSLOT;
+    uint32_t i;
+
+    p = putformat(out, p, "\nstatistics\n\n");
+    p = putformat(out, p, "instructions          %" PRIu64 "\n", st->instructions);
+    p = putformat(out, p, "bytes                 %" PRIu64 "\n", st->bytes);
+    p = putformat(out, p, "average length        %.2f bits, %.1f%% of the %d bit uncompressed length\n",
+            st->instructions ? st->bytes * 8.0 / st->instructions : 0.0,
+            st->instructions ? st->bytes * 800.0 / st->instructions / MAXTM32INSLEN : 0.0, MAXTM32INSLEN);
+    p = putformat(out, p, "illegal operations    %" PRIu64 "\n", st->illegal);
+
+    p = putformat(out, p, "\noperation sizes\n");
+    for(i=0;i<4;i++)
+        p = putformat(out, p, "  %-20s%12" PRIu64 "  %5.1f%%\n", sizenames[i], st->sizecount[i], slots ? st->sizecount[i] * 100.0 / slots : 0.0);
+
+    p = putformat(out, p, "\nslots empty or nop\n");
+    for(i=0;i<MAXSLOT;i++)
+        p = putformat(out, p, "  slot %-15u%12" PRIu64 "  %5.1f%%\n", i + 1, st->slotnops[i], st->instructions ? st->slotnops[i] * 100.0 / st->instructions : 0.0);
+
+    p = putformat(out, p, "\ndecision trees        %" PRIu64 ", %.2f instructions long on average, longest %" PRIu64 "\n",
+            st->trees, st->trees ? (double) st->instructions / st->trees : 0.0, st->longesttree);
+    for(i=0;i<TREEBUCKETS;i++)
+        if(st->treelengths[i])
+            p = putformat(out, p, "  %3u%-17s%12" PRIu64 "\n", i + 1, (i == TREEBUCKETS - 1) ? " or more long" : " long", st->treelengths[i]);
+
+    p = putformat(out, p, "\nformat fields\n");
+    for(i=0;i<formatcount;i++)
+        p = putformat(out, p, "  0x%04x              %12" PRIu64 "  %5.1f%%\n", (formats[i].index & 0xff) << 8 | formats[i].index >> 8,
+                formats[i].count, formats[i].count * 100.0 / st->instructions);
+
+    p = putformat(out, p, "\noperations\n");
+    for(i=0;i<opcount;i++)
+        p = putformat(out, p, "  %-20s%12" PRIu64 "  %5.1f%%\n", oplist[ops[i].index].opname, ops[i].count, ops[i].count * 100.0 / slots);
+    p = putformat(out, p, "\nend statistics\n");
+    return p;
+}
+
+static uint8_t *putstatsjson(struct OUTBUF *out, uint8_t *p, const struct TM32STATS *st, const struct RANKED *ops, uint32_t opcount, const struct RANKED *formats, uint32_t formatcount) {
+    uint32_t i;
+
+    p = putformat(out, p, "{\"instructions\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"uncompressedbits\":%d,\"illegal\":%" PRIu64,
+            st->instructions, st->bytes, MAXTM32INSLEN, st->illegal);
+    p = putformat(out, p, ",\"sizes\":{\"empty\":%" PRIu64 ",\"26\":%" PRIu64 ",\"34\":%" PRIu64 ",\"42\":%" PRIu64 "}",
+            st->sizecount[0], st->sizecount[1], st->sizecount[2], st->sizecount[3]);
+    p = putformat(out, p, ",\"slotnops\":[");
+    for(i=0;i<MAXSLOT;i++)
+        p = putformat(out, p, "%s%" PRIu64, i ? "," : "", st->slotnops[i]);
+    p = putformat(out, p, "],\"trees\":%" PRIu64 ",\"longesttree\":%" PRIu64 ",\"treelengths\":[", st->trees, st->longesttree);
+    for(i=0;i<TREEBUCKETS;i++)                                      // the last bucket is that length or more
+        p = putformat(out, p, "%s%" PRIu64, i ? "," : "", st->treelengths[i]);
+    p = putformat(out, p, "],\"formats\":{");
+    for(i=0;i<formatcount;i++)
+        p = putformat(out, p, "%s\"0x%04x\":%" PRIu64, i ? "," : "", (formats[i].index & 0xff) << 8 | formats[i].index >> 8, formats[i].count);
+    p = putformat(out, p, "},\"operations\":{");
+    for(i=0;i<opcount;i++)
+        p = putformat(out, p, "%s\"%s\":%" PRIu64, i ? "," : "", oplist[ops[i].index].opname, ops[i].count);
+    p = putformat(out, p, "}}\n");
+    return p;
+}
+
+// tmstatistics() decodes bytecount bytes at objbuf, at address offset, and prints statistics of the
+// instructions to the output file descriptor of ctx, as JSON if json, else as text.
+// returns 0 on success, -1 on error (which is reported)
+
+int32_t tmstatistics(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t bytecount, uint64_t offset, uint32_t json) {
+
+    struct OUTBUF *out = &ctx->out;
+    struct TM32STATS *st;
+    struct RANKED *ops, *formats;
+    uint32_t opcount, formatcount;
+    int32_t ret = -1;
+    uint8_t *p;
+
+    st = (struct TM32STATS *) calloc(1, sizeof(struct TM32STATS));
+    ops = (struct RANKED *) malloc(OPLISTSIZE * sizeof(struct RANKED));
+    formats = (struct RANKED *) malloc(FORMATS * sizeof(struct RANKED));
+    if(!st || !ops || !formats) {
+        fprintf(stderr, "Could not malloc space for statistics\n");
+        goto done;
+    }
+
+    gatherstats(ctx, objbuf, bytecount, offset, st);
+    opcount = rankcounts(st->opcount, OPLISTSIZE, ops);
+    formatcount = rankcounts(st->formatcount, FORMATS, formats);
+    p = out->buf + out->len;                                        // written after the lines main() printed to stdout,
+    if(json)                                                        // which outflush() sends out first
+        p = putstatsjson(out, p, st, ops, opcount, formats, formatcount);
+    else
+        p = putstatstext(out, p, st, ops, opcount, formats, formatcount);
+    out->len = p - out->buf;
+    outflush(out);
+    ret = 0;
+
+done:
+    free(st);
+    free(ops);
+    free(formats);
+    return ret;
+}
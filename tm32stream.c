@@ -0,0 +1,154 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com>
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#if defined(__MINGW32__)
+#include "windows/byteswap.h"
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <byteswap.h>
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "tm32dis.h"
+
+
+// Streaming mode disassembles an input that cannot be mapped or seeked, such as a pipe, in constant
+// memory. The stream is read a chunk at a time into one buffer. Instructions are disassembled up to
+// STREAMCARRY bytes from the end of what has been read, so that every one of them is whole. Those
+// last bytes, and the state of the format field chain, are carried over to the next chunk. Memory
+// images are transposed a chunk at a time, which works because a chunk is a whole count of blocks.
+
+#define STREAMCHUNK     (256 * 1024)                    //   bytes read at a time, a multiple of the 32 byte block
+#define STREAMCARRY     (MAXTM32INSLEN / 8)             //   bytes held back for an instruction split across chunks
+
+// readstream() reads up to count bytes from fin into buf, stopping early only at end of file.
+// returns the count of bytes read
+static size_t readstream(FILE *fin, uint8_t *buf, size_t count) {
+    size_t got = 0, n;
+
+    while(got < count && (n = fread(buf + got, 1, count - got, fin)) > 0)
+        got += n;
+    return got;
+}
+
+// tmdisassemblestream() disassembles count bytes (0 for all) of the stream fin, after skipping skip
+// bytes, at address offset, transposing it first if memoryimage. name is the name of the input, or
+// NULL for standard input. The text is byte for byte the disassembly that a run on the same data
+// as a file would print, with only the lines before it different.
+// returns 0 on success, -1 on error (which is reported)
+
+int32_t tmdisassemblestream(struct TM32CTX *ctx, FILE *fin, const char *name, uint32_t memoryimage, uint64_t skip, uint64_t count, uint64_t offset) {
+
+    struct OUTBUF *out = &ctx->out;
+    struct TM32SPAN span = { 0, 0, offset, 0, 0 };
+    uint8_t *buf, *raw = NULL, *p;
+    uint64_t base = 0;                                              // bytes of the stream before buf[0], after the skip
+    size_t datalen = 0;                                             // bytes of the stream in buf
+    size_t got, valid, end;
+    uint32_t eof = FALSE;
+    int32_t ret = -1;
+
+#if defined(__MINGW32__)
+    if(fin == stdin)
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    buf = (uint8_t *) malloc(STREAMCARRY + STREAMCHUNK + OBJPADDING);
+    if(memoryimage)
+        raw = (uint8_t *) malloc(STREAMCHUNK);
+    if(!buf || (memoryimage && !raw)) {
+        fprintf(stderr, "Could not malloc %d bytes stream buffer\n", STREAMCARRY + STREAMCHUNK + OBJPADDING);
+        goto done;
+    }
+
+    if(name)
+        fprintf(stdout, "Streaming from file '%s'\n", name);
+    else
+        fprintf(stdout, "Streaming from standard input\n");
+
+    while(base < skip) {                                            // read the skipped bytes and throw them away
+        got = readstream(fin, buf, (skip - base < STREAMCHUNK) ? skip - base : STREAMCHUNK);
+        if(!got) {
+            fprintf(stderr, "Skip parameter too large for stream length\n");
+            goto done;
+        }
+        base += got;
+    }
+    base = 0;
+
+    if(skip)
+        fprintf(stdout, "Skipping %" PRId64 " (0x%" PRIx64 ") bytes\n", skip, skip);
+    if(offset)
+        fprintf(stdout, "Using 0x%" PRIx64 " adjustment offset\n", offset);
+    if(count)
+        fprintf(stdout, "Disassembling %" PRId64 " (0x%" PRIx64 ") bytes\n", count, count);
+    if(memoryimage)
+        fprintf(stdout, "Transposing memory image from bit-striped to sequential bytes\n");
+
+    span.formatfield = bswap_16(BRTARGETFORMATBYTES);               // start with an uncompressed branch target
+    if(TRACING(ctx, TRACE_ALL))                                     // trace output may share the stream through stdio, so
+        out->flushlimit = 0;                                        // flush after every instruction to keep the two in order
+    p = putdisassemblystart(ctx, out->buf + out->len);
+
+    while(!eof) {
+        if(memoryimage) {                                           // a partial block at the end is transposed with
+            got = readstream(fin, raw, STREAMCHUNK);                // zeros after it, as it is from a file
+            memset(raw + got, 0, (32 - got % 32) % 32);
+            valid = datalen + (got + 31) / 32 * 32;
+            extractmemimginstructions(ctx, raw, buf + datalen, (got + 31) / 32 * 32);
+        } else {
+            got = readstream(fin, buf + datalen, STREAMCHUNK);
+            valid = datalen + got;
+        }
+        eof = (got < STREAMCHUNK);
+        datalen += got;
+        if(eof)                                                     // instructions run on into zeros past the end
+            memset(buf + valid, 0, OBJPADDING);
+
+        end = eof ? datalen : datalen - STREAMCARRY;
+        if(count && base + end >= count) {
+            end = count - base;
+            eof = TRUE;
+        }
+        span.end = end;
+        p = disassemblespan(ctx, out, p, buf, &span);
+        if(eof)
+            break;
+
+        memmove(buf, buf + span.start, datalen - span.start);       // carry the unused bytes over to the next chunk
+        base += span.start;
+        datalen -= span.start;
+        span.start = 0;
+    }
+    if(count && base + end < count)
+        fprintf(stderr, "Stream ended after %" PRId64 " of the %" PRId64 " bytes to disassemble\n", base + datalen, count);
+
+    p = putdisassemblyend(ctx, p);
+    out->len = p - out->buf;
+    outflush(out);
+    ret = 0;
+
+done:
+    free(raw);
+    free(buf);
+    return ret;
+}
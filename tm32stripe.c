@@ -0,0 +1,172 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com>
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#if defined(__MINGW32__)
+#include "windows/byteswap.h"
+#else
+#include <byteswap.h>
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "tm32dis.h"
+
+
+// Striped mode decodes a memory image through a small cache of transposed blocks, rather than
+// transposing the whole window before the disassembly starts. The blocks are laid from a base
+// offset in the file (--stripe-base), not from -s, so -s may name any byte of the image. A byte
+// address is split into its block and the byte within that block, and a block is transposed only
+// when the decoder first reads from it, then kept until another block takes its cache line.
+
+#define STRIPECACHEBLOCKS   64                          //   blocks kept transposed, direct mapped by block number
+
+struct STRIPECACHE {
+    const uint8_t *raw;                                 //   the bit-striped bytes, from the first block of the window
+    uint64_t rawlength;                                 //   bytes at raw that may be read, the rest read as zeros
+    uint64_t tags[STRIPECACHEBLOCKS];                   //   block number + 1 held by each line, 0 if none
+    uint8_t lines[STRIPECACHEBLOCKS][MEMIMGBLOCK];
+    uint64_t transposed;                                //   blocks transposed, including any read again after eviction
+};
+
+// stripeblock() returns the transposed bytes of block number block of sc, transposing it first
+// if it is not in the cache
+static const uint8_t *stripeblock(struct TM32CTX *ctx, struct STRIPECACHE *sc, uint64_t block) {
+    uint64_t start = block * MEMIMGBLOCK;
+    uint32_t line = block % STRIPECACHEBLOCKS, i;
+    uint8_t *out = sc->lines[line];
+
+    if(sc->tags[line] == block + 1)
+        return out;
+    if(start >= sc->rawlength)
+        memset(out, 0, MEMIMGBLOCK);
+    else
+        transposememimgblock(sc->raw + start, out, (sc->rawlength - start < MEMIMGBLOCK) ? sc->rawlength - start : MEMIMGBLOCK);
+    sc->tags[line] = block + 1;
+    sc->transposed++;
+
+    if(TRACING(ctx, TRACE_MEMIMG)) {
+        fprintf(ctx->traceout, "%04" PRIx64 ": ", start);
+        for(i=0;i<MEMIMGBLOCK;i++)
+            fprintf(ctx->traceout, "%02x%s", out[i], (i == MEMIMGBLOCK / 2 - 1) ? "\n      " : " ");
+        fprintf(ctx->traceout, "\n");
+    }
+    return out;
+}
+
+// stripefetch() copies count transposed bytes from byte index pos of the window of sc to buf
+static void stripefetch(struct TM32CTX *ctx, struct STRIPECACHE *sc, uint64_t pos, uint8_t *buf, uint32_t count) {
+    uint32_t n, within;
+
+    while(count > 0) {
+        within = pos % MEMIMGBLOCK;
+        n = (MEMIMGBLOCK - within < count) ? MEMIMGBLOCK - within : count;
+        memcpy(buf, stripeblock(ctx, sc, pos / MEMIMGBLOCK) + within, n);
+        buf += n;
+        pos += n;
+        count -= n;
+    }
+}
+
+// disassemblestriped() renders the instructions of span as disassemblespan() does, with the byte
+// indexes of span counted from the start of the window of sc. returns a pointer to the end of the text
+static uint8_t *disassemblestriped(struct TM32CTX *ctx, struct OUTBUF *out, uint8_t *p, struct STRIPECACHE *sc, struct TM32SPAN *span) {
+
+    struct TM32INSTR ins;
+    uint8_t instruction[MAXTM32INSLEN / 8 + OBJPADDING];            // the decoder may read past the instruction
+    uint16_t currentformatfield = span->formatfield;
+    uint64_t pos = span->start, offset = span->offset;
+    uint32_t insnum = span->insnum;
+
+    memset(instruction, 0, sizeof(instruction));
+    while(pos < span->end) {
+        p = outsync(out, p);
+        stripefetch(ctx, sc, pos, instruction, MAXTM32INSLEN / 8);
+        decodeinstruction(ctx, instruction, currentformatfield, offset, &ins);
+
+        if(ins.length * 8 == MAXTM32INSLEN)                         // start of a new decision tree
+            insnum = 0;
+        else
+            insnum++;
+
+        p = renderinstruction(p, ctx->printoutformat, &ins, instruction, insnum);
+
+        pos += ins.length;
+        offset += ins.length;
+        currentformatfield = ins.nextformatfield;
+    }
+    span->start = pos;
+    span->offset = offset;
+    span->formatfield = currentformatfield;
+    span->insnum = insnum;
+    return p;
+}
+
+// tmdisassemblestriped() disassembles count bytes of the memory image in img from byte skip, at address
+// offset, with the bit-striped blocks of the image starting at byte base of the file. Only the blocks
+// that hold the instructions decoded are read and transposed, so skip need not be on a block.
+// returns 0 on success, -1 on error (which is reported)
+
+int32_t tmdisassemblestriped(struct TM32CTX *ctx, struct OBJIMAGE *img, uint64_t base, uint64_t skip, uint64_t count, uint64_t offset) {
+
+    struct OUTBUF *out = &ctx->out;
+    struct STRIPECACHE *sc;
+    struct TM32SPAN span;
+    uint64_t windowstart, windowlength;
+    uint8_t *p;
+
+    if(skip < base) {
+        fprintf(stderr, "The skip 0x%" PRIx64 " is before the --stripe-base 0x%" PRIx64 "\n", skip, base);
+        return -1;
+    }
+    windowstart = skip - (skip - base) % MEMIMGBLOCK;               // the block that holds the first byte
+    windowlength = MEMIMGBYTES(skip + count - windowstart);         // and the blocks the last instruction may reach
+    if(windowlength > img->filelength - windowstart)
+        windowlength = img->filelength - windowstart;
+
+    if(!(sc = (struct STRIPECACHE *) calloc(1, sizeof(struct STRIPECACHE)))) {
+        fprintf(stderr, "Could not malloc space for the memory image block cache\n");
+        return -1;
+    }
+    if(!(sc->raw = mapobjwindow(img, windowstart, windowlength, FALSE))) {
+        fprintf(stderr, "Could not read from the memory image\n");
+        free(sc);
+        return -1;
+    }
+    sc->rawlength = windowlength;
+
+    span.start = skip - windowstart;
+    span.end = span.start + count;
+    span.offset = offset;
+    span.formatfield = bswap_16(BRTARGETFORMATBYTES);               // start with an uncompressed branch target
+    span.insnum = 0;
+
+    if(TRACING(ctx, TRACE_ALL))                                     // keep the trace and the text in order
+        out->flushlimit = 0;
+    p = putdisassemblystart(ctx, out->buf + out->len);
+    p = disassemblestriped(ctx, out, p, sc, &span);
+    p = putdisassemblyend(ctx, p);
+    out->len = p - out->buf;
+    outflush(out);
+
+    TRACE(ctx, TRACE_MEMIMG, "Transposed %" PRIu64 " blocks of the memory image\n", sc->transposed);
+    free(sc);
+    return 0;
+}
@@ -0,0 +1,325 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com>
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#if !defined(__MINGW32__)
+#define _DEFAULT_SOURCE                             // for pthreads and sysconf() under -std=c99
+#define _BSD_SOURCE
+#endif
+#if defined(__MINGW32__)
+#include "windows/byteswap.h"
+#else
+#include <byteswap.h>
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#if defined(TM32_HAVE_PTHREAD)
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#include "tm32dis.h"
+
+
+// The format field of each instruction is held in the instruction before it, so the instruction
+// stream can only be decoded in order. But the chain of format fields is cheap to follow on its own:
+// one table lookup for the length and one two byte load per instruction, with no operations decoded.
+// splitspans() walks the chain once, and cuts the stream into spans at the start of decision trees,
+// where the chain restarts. Each span can then be decoded and rendered on a different thread, and
+// the text of the spans written out in their original order.
+
+// splitspans() divides the bytecount bytes of instruction stream at objbuf into spans of at least
+// target bytes, starting each new span at a decision tree where possible. A stream with no decision
+// tree for four times target bytes is cut between any two instructions instead.
+// returns the count of spans, at most maxspans
+
+uint64_t splitspans(uint8_t *objbuf, uint64_t bytecount, uint64_t offset, uint64_t target, struct TM32SPAN *spans, uint64_t maxspans) {
+
+    uint16_t formatfield = bswap_16(BRTARGETFORMATBYTES);
+    uint64_t pos = 0, count = 1, spanlength;
+    uint32_t insnum = 0, length;
+
+    spans[0].start = 0;
+    spans[0].offset = offset;
+    spans[0].formatfield = formatfield;
+    spans[0].insnum = 0;
+
+    while(pos < bytecount) {
+        length = GETFORMATDESC(formatfield)->inslength / 8;
+        spanlength = pos - spans[count-1].start;
+        if(count < maxspans && spanlength >= target && (length * 8 == MAXTM32INSLEN || spanlength >= 4 * target)) {
+            spans[count-1].end = pos;
+            spans[count].start = pos;
+            spans[count].offset = offset + pos;
+            spans[count].formatfield = formatfield;
+            spans[count].insnum = insnum;
+            count++;
+        }
+        insnum = (length * 8 == MAXTM32INSLEN) ? 0 : insnum + 1;
+        memcpy(&formatfield, objbuf + pos, 2);                      // format field for the next instruction
+        pos += length;
+    }
+    spans[count-1].end = bytecount;
+    return count;
+}
+
+// struct SPANLIST is the job list of disassemblethreaded(): one job per span of one object buffer
+
+struct SPANLIST {
+    uint8_t *objbuf;
+    struct TM32SPAN *spans;
+};
+
+static uint8_t *renderspanjob(struct TM32CTX *ctx, struct OUTBUF *out, uint8_t *p, void *jobs, uint64_t index) {
+    struct SPANLIST *list = (struct SPANLIST *) jobs;
+
+    return disassemblespan(ctx, out, p, list->objbuf, &list->spans[index]);
+}
+
+// disassemblethreaded() disassembles bytecount bytes at objbuf, like disassemblespan(), on
+// ctx->threads worker threads. The text is appended at p, in the output buffer of ctx, and is
+// byte for byte the same as a single-threaded run.
+// returns a pointer to the end of the text
+
+uint8_t *disassemblethreaded(struct TM32CTX *ctx, uint8_t *p, uint8_t *objbuf, uint64_t bytecount, uint64_t offset) {
+
+    struct SPANLIST list;
+    struct TM32SPAN whole = { 0, bytecount, offset, 0, 0 };
+    uint64_t target, maxspans, spancount;
+
+    target = bytecount / ((uint64_t) ctx->threads * SPANSPERTHREAD);
+    target = (target < SPANMINBYTES) ? SPANMINBYTES : (target > SPANMAXBYTES) ? SPANMAXBYTES : target;
+    maxspans = bytecount / target + 1;
+
+    list.objbuf = objbuf;
+    if(ctx->resync)                                                 // where the sweep restarts depends on the data before
+        list.spans = NULL;                                          // it, so it cannot be split ahead of time
+    else
+        list.spans = (struct TM32SPAN *) malloc(maxspans * sizeof(struct TM32SPAN));
+    if(!list.spans) {
+        whole.formatfield = bswap_16(BRTARGETFORMATBYTES);
+        return disassemblespan(ctx, &ctx->out, p, objbuf, &whole);
+    }
+    spancount = splitspans(objbuf, bytecount, offset, target, list.spans, maxspans);
+    p = renderordered(ctx, p, renderspanjob, &list, spancount);
+    free(list.spans);
+    return p;
+}
+
+#if defined(TM32_HAVE_PTHREAD)
+
+// struct JOBTEXT collects the text of one job as a worker renders it
+
+struct JOBTEXT {
+    uint8_t *text;
+    size_t len;
+    size_t size;
+    uint32_t done;                                      //   the job has been rendered
+    uint32_t failed;                                    //   some of its text could not be stored
+};
+
+// struct JOBPOOL is shared by the workers. Each takes the next unclaimed job in turn, so a thread
+// that is given quick jobs simply takes more of them. The workers may run at most inflight jobs
+// ahead of the output, which bounds the memory held by rendered text waiting to be written
+
+struct JOBPOOL {
+    uint8_t *(*render)(struct TM32CTX *ctx, struct OUTBUF *out, uint8_t *p, void *jobs, uint64_t index);
+    void *jobs;
+    struct JOBTEXT *texts;
+    uint64_t jobcount;
+    uint64_t next;                                      //   next job for a worker to claim
+    uint64_t emitted;                                   //   count of jobs written to the output
+    uint64_t inflight;
+    pthread_mutex_t lock;
+    pthread_cond_t claimable;                           //   signalled as jobs are written out
+    pthread_cond_t rendered;                            //   signalled as jobs are rendered
+};
+
+struct JOBWORKER {
+    pthread_t thread;
+    struct TM32CTX ctx;                                 //   private context, with its own output buffer
+    struct JOBPOOL *pool;
+};
+
+// appendjobtext() is the output sink of a worker. It appends len bytes at buf to a JOBTEXT
+static int32_t appendjobtext(void *sinkarg, const uint8_t *buf, size_t len) {
+    struct JOBTEXT *t = (struct JOBTEXT *) sinkarg;
+    uint8_t *text;
+    size_t size;
+
+    if(t->len + len > t->size) {
+        for(size = t->size ? t->size : OUTBUFSIZE; size < t->len + len; size *= 2)
+            ;
+        if(!(text = (uint8_t *) realloc(t->text, size))) {
+            t->failed = TRUE;
+            return -1;
+        }
+        t->text = text;
+        t->size = size;
+    }
+    memcpy(t->text + t->len, buf, len);
+    t->len += len;
+    return 0;
+}
+
+static void *jobworker(void *arg) {
+    struct JOBWORKER *w = (struct JOBWORKER *) arg;
+    struct JOBPOOL *pool = w->pool;
+    struct OUTBUF *out = &w->ctx.out;
+    uint64_t i;
+    uint8_t *p;
+
+    pthread_mutex_lock(&pool->lock);
+    while(TRUE) {
+        while(pool->next < pool->jobcount && pool->next >= pool->emitted + pool->inflight)
+            pthread_cond_wait(&pool->claimable, &pool->lock);
+        if(pool->next >= pool->jobcount)
+            break;
+        i = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+
+        out->sinkarg = &pool->texts[i];
+        p = pool->render(&w->ctx, out, out->buf, pool->jobs, i);
+        out->len = p - out->buf;
+        outflush(out);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->texts[i].done = TRUE;
+        pthread_cond_broadcast(&pool->rendered);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+#endif
+
+// renderordered() renders jobcount jobs with render(), and appends their text at p, in the output
+// buffer of ctx, in job order. The jobs are rendered on ctx->threads worker threads, each with a
+// private copy of ctx. With one thread or one job, with tracing on, or where the threads cannot be
+// set up, the jobs are simply rendered in turn on the calling thread.
+// returns a pointer to the end of the text
+
+uint8_t *renderordered(struct TM32CTX *ctx, uint8_t *p, uint8_t *(*render)(struct TM32CTX *ctx, struct OUTBUF *out, uint8_t *p, void *jobs, uint64_t index), void *jobs, uint64_t jobcount) {
+
+    uint64_t i;
+#if defined(TM32_HAVE_PTHREAD)
+    struct JOBPOOL pool;
+    struct JOBWORKER *workers = NULL;
+    uint32_t t, started = 0;
+
+    if(ctx->threads < 2 || jobcount < 2 || TRACING(ctx, TRACE_ALL))
+        goto singlethreaded;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.render = render;
+    pool.jobs = jobs;
+    pool.jobcount = jobcount;
+    pool.inflight = (uint64_t) ctx->threads * SPANSINFLIGHT;
+    pool.texts = (struct JOBTEXT *) calloc(jobcount, sizeof(struct JOBTEXT));
+    workers = (struct JOBWORKER *) calloc(ctx->threads, sizeof(struct JOBWORKER));
+    if(!pool.texts || !workers)
+        goto nothreads;
+
+    for(t=0;t<ctx->threads;t++) {
+        workers[t].ctx = *ctx;
+        workers[t].ctx.tracemask = 0;
+        workers[t].ctx.threads = 1;
+        workers[t].pool = &pool;
+        if(outinit(&workers[t].ctx.out, -1, OUTBUFSIZE) < 0) {
+            workers[t].ctx.out.buf = NULL;
+            break;
+        }
+        workers[t].ctx.out.sink = appendjobtext;
+    }
+    if(t < ctx->threads)
+        goto nothreads;
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.claimable, NULL);
+    pthread_cond_init(&pool.rendered, NULL);
+    for(t=0;t<ctx->threads;t++)                                     // thread handles are kept in the first started
+        if(pthread_create(&workers[started].thread, NULL, jobworker, &workers[t]) == 0)
+            started++;                                              // workers, whichever threads failed to start
+    if(!started) {
+        pthread_cond_destroy(&pool.rendered);
+        pthread_cond_destroy(&pool.claimable);
+        pthread_mutex_destroy(&pool.lock);
+        goto nothreads;
+    }
+
+    ctx->out.len = p - ctx->out.buf;
+    for(i=0;i<jobcount;i++) {
+        pthread_mutex_lock(&pool.lock);
+        while(!pool.texts[i].done)
+            pthread_cond_wait(&pool.rendered, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+
+        if(pool.texts[i].failed)
+            fprintf(stderr, "Could not malloc the text of disassembly job %" PRIu64 "\n", i);
+        outappend(&ctx->out, pool.texts[i].text, pool.texts[i].len);
+        free(pool.texts[i].text);
+        pool.texts[i].text = NULL;
+
+        pthread_mutex_lock(&pool.lock);
+        pool.emitted++;
+        pthread_cond_broadcast(&pool.claimable);
+        pthread_mutex_unlock(&pool.lock);
+    }
+
+    for(t=0;t<started;t++)
+        pthread_join(workers[t].thread, NULL);
+    for(t=0;t<ctx->threads;t++)
+        free(workers[t].ctx.out.buf);
+    pthread_cond_destroy(&pool.rendered);
+    pthread_cond_destroy(&pool.claimable);
+    pthread_mutex_destroy(&pool.lock);
+    free(workers);
+    free(pool.texts);
+    return ctx->out.buf + ctx->out.len;
+
+nothreads:
+    if(workers)
+        for(t=0;t<ctx->threads;t++)
+            free(workers[t].ctx.out.buf);
+    free(workers);
+    free(pool.texts);
+singlethreaded:
+#endif
+    for(i=0;i<jobcount;i++)
+        p = render(ctx, &ctx->out, p, jobs, i);
+    return p;
+}
+
+#if defined(TM32_HAVE_PTHREAD)
+
+// onlinecpus() returns the count of processors available, for --threads 0
+uint32_t onlinecpus(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (n > 0) ? (uint32_t) n : 1;
+}
+
+#else
+
+uint32_t onlinecpus(void) {
+    return 1;
+}
+
+#endif
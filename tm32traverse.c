@@ -0,0 +1,318 @@
+// An open source disassembler for the Trimedia TM3260, a five issue-slot VLIW processor core.
+//
+// More information in US Patents #5,787,302, #5,826,054, #5,852,741, #5,878,267 and #6,704,859
+//
+// (c) 2011 asbokid <ballymunboy@gmail.com>
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#if defined(__MINGW32__)
+#include "windows/byteswap.h"
+#else
+#include <byteswap.h>
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "tm32dis.h"
+#include "tm32disinstrs.h"
+
+
+// Traversal mode disassembles only the code that can be reached from a set of entry points, rather
+// than sweeping through the whole image and on into its data. Each entry point starts a walk along
+// the instruction stream, which follows the format field chain just as a linear sweep does, but
+// stops at an illegal operation, at an instruction that has already been walked, or where an
+// unconditional jump takes effect. The targets of the jumps met on the way are added to a worklist
+// as new entry points: the immediates of jmpi and ijmpi, and the registers of jmpt, ijmpt, jmpf
+// and ijmpf when uimm last loaded them on the same path. A bitmap marks each instruction walked.
+// The walks are then rendered in address order, with a note for each stretch that was not reached.
+
+#define JUMPDELAYSLOTS  3                               //   instructions issued after a jump, before it is taken
+
+#define OPCODE_JMPT     176
+#define OPCODE_IJMPT    177
+#define OPCODE_JMPI     178
+#define OPCODE_IJMPI    179
+#define OPCODE_JMPF     180
+#define OPCODE_IJMPF    181
+#define OPCODE_UIMM     191
+
+#define REGISTERS       128
+
+// struct REGSTATE holds the registers whose value is known on a path, from uimm operations
+
+struct REGSTATE {
+    uint32_t known[REGISTERS / 32];                     //   a bit for each register
+    uint32_t value[REGISTERS];
+};
+
+struct WORKITEM {
+    uint64_t pos;                                       //   byte index of the entry point
+    struct REGSTATE regs;                               //   registers known on the path that reached it
+};
+
+struct TRAVERSAL {
+    uint8_t *objbuf;
+    uint64_t bytecount;
+    uint64_t offset;
+    uint8_t *walked;                                    //   a bit for each byte that starts a walked instruction
+    struct WORKITEM *work;                              //   the worklist, used as a stack
+    uint64_t workcount;
+    uint64_t worksize;
+    struct TM32SPAN *walks;                             //   the runs of instructions walked
+    uint64_t walkcount;
+    uint64_t walksize;
+    uint64_t outside;                                   //   count of jump targets outside the image
+};
+
+#define ISWALKED(t, pos)    ((t)->walked[(pos) / 8] & (1 << ((pos) % 8)))
+#define SETWALKED(t, pos)   ((t)->walked[(pos) / 8] |= (1 << ((pos) % 8)))
+
+// growarray() makes room for one more element in the array *array of *count elements of size
+// bytes, doubling its allocation *allocated when full. returns 0 on success, -1 if out of memory
+static int32_t growarray(void **array, uint64_t count, uint64_t *allocated, size_t size) {
+    void *grown;
+
+    if(count < *allocated)
+        return 0;
+    if(!(grown = realloc(*array, (*allocated ? *allocated * 2 : 16) * size)))
+        return -1;
+    *array = grown;
+    *allocated = *allocated ? *allocated * 2 : 16;
+    return 0;
+}
+
+// pushtarget() adds the jump target at address target to the worklist, with the registers known
+// when the jump was made. returns 0 on success, -1 if out of memory
+static int32_t pushtarget(struct TRAVERSAL *t, uint64_t target, const struct REGSTATE *regs) {
+    struct WORKITEM *item;
+
+    if(target < t->offset || target - t->offset >= t->bytecount) {
+        t->outside++;
+        return 0;
+    }
+    if(ISWALKED(t, target - t->offset))
+        return 0;
+    if(growarray((void **) &t->work, t->workcount, &t->worksize, sizeof(struct WORKITEM)) < 0)
+        return -1;
+    item = &t->work[t->workcount++];
+    item->pos = target - t->offset;
+    if(regs)
+        item->regs = *regs;
+    else
+        memset(&item->regs, 0, sizeof(struct REGSTATE));
+    return 0;
+}
+
+// followjumps() queues the targets of the jumps in instruction ins, reading the registers as they
+// were before it issued. returns TRUE if one of them is always taken, or -1 if out of memory
+static int32_t followjumps(struct TRAVERSAL *t, const struct TM32INSTR *ins, const struct REGSTATE *regs) {
+    const struct TM32OP *dop;
+    uint32_t i, always = FALSE;
+
+    for(i=0;i<MAXSLOT;i++) {
+        dop = &ins->op[i];
+        if(dop->form == FORM_NOP || dop->guard == 0)                // r0 is always false, so the jump is never taken
+            continue;
+        switch(oplist[dop->opindex].opcode) {
+            case OPCODE_JMPI:
+            case OPCODE_IJMPI:
+                if(pushtarget(t, (uint32_t) dop->param, regs) < 0)
+                    return -1;
+                always |= (dop->guard == 1);
+                break;
+            case OPCODE_JMPT:
+            case OPCODE_IJMPT:
+            case OPCODE_JMPF:
+            case OPCODE_IJMPF:
+                if(regs->known[dop->src2 / 32] & (1u << (dop->src2 % 32)))
+                    if(pushtarget(t, regs->value[dop->src2], regs) < 0)
+                        return -1;
+                if(oplist[dop->opindex].opcode <= OPCODE_IJMPT)     // taken on r1, which is always true
+                    always |= (dop->guard == 1 && dop->src1 == 1);
+                else                                                // or on r0, which is always false
+                    always |= (dop->guard == 1 && dop->src1 == 0);
+                break;
+            default:
+                break;
+        }
+    }
+    return always;
+}
+
+// trackregisters() updates regs with the results of instruction ins. A register loaded by an
+// unguarded uimm becomes known, and one written by anything else becomes unknown
+static void trackregisters(const struct TM32INSTR *ins, struct REGSTATE *regs) {
+    const struct TM32OP *dop;
+    uint32_t i, opcode;
+
+    for(i=0;i<MAXSLOT;i++) {
+        dop = &ins->op[i];
+        opcode = oplist[dop->opindex].opcode;
+        if(opcode >= OPCODE_JMPT && opcode <= OPCODE_IJMPF)         // jumps write no register
+            continue;
+        switch(dop->form) {
+            case FORM_BINARY:
+            case FORM_UNARY:
+            case FORM_PARAM_UNARY:
+            case FORM_ZEROARY:
+            case FORM_PARAM32:
+                if(opcode == OPCODE_UIMM && dop->guard == 1) {
+                    regs->known[dop->dst / 32] |= 1u << (dop->dst % 32);
+                    regs->value[dop->dst] = (uint32_t) dop->param;
+                } else
+                    regs->known[dop->dst / 32] &= ~(1u << (dop->dst % 32));
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// walkfrom() walks the instruction stream from the worklist entry item, which starts a decision
+// tree, and records the run of instructions it covers. returns 0 on success, -1 if out of memory
+static int32_t walkfrom(struct TM32CTX *ctx, struct TRAVERSAL *t, const struct WORKITEM *item) {
+    struct TM32INSTR ins;
+    struct REGSTATE regs = item->regs;
+    uint16_t formatfield = bswap_16(BRTARGETFORMATBYTES);
+    uint64_t pos = item->pos;
+    int32_t delay = -1, always;                                     // instructions left before a jump is always taken
+
+    while(pos < t->bytecount && !ISWALKED(t, pos) && delay != 0) {
+        decodeinstruction(ctx, t->objbuf + pos, formatfield, t->offset + pos, &ins);
+        if(!instructionclean(&ins))                                 // walked off the end of the code into data
+            break;
+
+        if((always = followjumps(t, &ins, &regs)) < 0)
+            return -1;
+        if(always && delay < 0)
+            delay = JUMPDELAYSLOTS + 1;
+        trackregisters(&ins, &regs);
+
+        SETWALKED(t, pos);
+        pos += ins.length;
+        formatfield = ins.nextformatfield;
+        if(delay > 0)
+            delay--;
+    }
+
+    if(pos > item->pos) {
+        if(growarray((void **) &t->walks, t->walkcount, &t->walksize, sizeof(struct TM32SPAN)) < 0)
+            return -1;
+        t->walks[t->walkcount].start = item->pos;
+        t->walks[t->walkcount].end = pos;
+        t->walks[t->walkcount].offset = t->offset + item->pos;
+        t->walks[t->walkcount].formatfield = bswap_16(BRTARGETFORMATBYTES);
+        t->walks[t->walkcount].insnum = 0;
+        t->walkcount++;
+    }
+    return 0;
+}
+
+static int comparewalks(const void *a, const void *b) {
+    const struct TM32SPAN *x = (const struct TM32SPAN *) a, *y = (const struct TM32SPAN *) b;
+
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+// putunreached() writes the note for the bytes from start to end that no walk reached
+static uint8_t *putunreached(uint8_t *p, const struct TRAVERSAL *t, uint64_t start, uint64_t end) {
+    p = putstr(p, "\n(* 0x");
+    p = puthex(p, t->offset + start, 8);
+    p = putstr(p, " .. 0x");
+    p = puthex(p, t->offset + end - 1, 8);
+    p = putstr(p, " : ");
+    p = putudec(p, end - start);
+    return putstr(p, " bytes not reached *)\n");
+}
+
+static uint8_t *renderwalkjob(struct TM32CTX *ctx, struct OUTBUF *out, uint8_t *p, void *jobs, uint64_t index) {
+    struct TRAVERSAL *t = (struct TRAVERSAL *) jobs;
+    struct TM32SPAN walk = t->walks[index];
+    uint64_t previous = index ? t->walks[index - 1].end : 0;
+
+    p = outsync(out, p);
+    if(walk.start > previous && !MACHINEFORMAT(ctx->printoutformat))
+        p = putunreached(p, t, previous, walk.start);
+    p = disassemblespan(ctx, out, p, t->objbuf, &walk);
+    if(index == t->walkcount - 1 && t->walks[index].end < t->bytecount && !MACHINEFORMAT(ctx->printoutformat))
+        p = putunreached(outsync(out, p), t, t->walks[index].end, t->bytecount);
+    return p;
+}
+
+// tmdisassembletraverse() disassembles the code reachable from the entrycount addresses in entries,
+// within the bytecount bytes at objbuf, which are at address offset. With no entries, the walk
+// starts at offset. The text goes to the output buffer of ctx, which is flushed at the end.
+// returns 0 on success, -1 on error (which is reported)
+
+int32_t tmdisassembletraverse(struct TM32CTX *ctx, uint8_t *objbuf, uint64_t bytecount, uint64_t offset, const uint64_t *entries, uint32_t entrycount) {
+
+    struct OUTBUF *out = &ctx->out;
+    struct TM32CTX quiet = *ctx;
+    struct TRAVERSAL t;
+    struct WORKITEM item;
+    uint64_t i, reached = 0;
+    int32_t ret = -1;
+    uint8_t *p;
+
+    memset(&t, 0, sizeof(t));
+    t.objbuf = objbuf;
+    t.bytecount = bytecount;
+    t.offset = offset;
+    if(!(t.walked = (uint8_t *) calloc(bytecount / 8 + 1, 1))) {
+        fprintf(stderr, "Could not malloc %" PRId64 " bytes traversal bitmap\n", bytecount / 8 + 1);
+        return -1;
+    }
+
+    for(i=0;i<entrycount || (i == 0 && entrycount == 0);i++)
+        if(pushtarget(&t, entrycount ? entries[i] : offset, NULL) < 0)
+            goto nomemory;
+    if(t.outside)
+        fprintf(stderr, "%" PRId64 " entry points are outside the disassembled bytes\n", t.outside);
+
+    quiet.tracemask = 0;                                            // the instructions are traced as they are rendered
+    while(t.workcount) {
+        item = t.work[--t.workcount];
+        if(walkfrom(&quiet, &t, &item) < 0)
+            goto nomemory;
+    }
+
+    qsort(t.walks, t.walkcount, sizeof(struct TM32SPAN), comparewalks);
+    for(i=0;i<t.walkcount;i++)
+        reached += t.walks[i].end - t.walks[i].start;
+    fprintf(stdout, "Reached %" PRId64 " (0x%" PRIx64 ") bytes of code in %" PRId64 " runs\n", reached, reached, t.walkcount);
+
+    if(TRACING(ctx, TRACE_ALL))                                     // trace output may share the stream through stdio, so
+        out->flushlimit = 0;                                        // flush after every instruction to keep the two in order
+    p = putdisassemblystart(ctx, out->buf + out->len);
+    if(t.walkcount)
+        p = renderordered(ctx, p, renderwalkjob, &t, t.walkcount);
+    else if(!MACHINEFORMAT(ctx->printoutformat))
+        p = putunreached(p, &t, 0, bytecount);
+    p = putdisassemblyend(ctx, p);
+    out->len = p - out->buf;
+    outflush(out);
+    ret = 0;
+    goto done;
+
+nomemory:
+    fprintf(stderr, "Could not malloc space for the traversal worklist\n");
+done:
+    free(t.walked);
+    free(t.work);
+    free(t.walks);
+    return ret;
+}
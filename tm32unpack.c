@@ -24,6 +24,7 @@
 #endif
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 #include "tm32dis.h"
@@ -40,103 +41,148 @@
 // 
 // In practise, an eight byte array is used. This allows a uint64_t ptr to be used which simplifies bitwise operations
 // 
-uint64_t unpackoperation(uint8_t *instruction, uint16_t formatbits, uint32_t slotnumber) {
+uint64_t unpackoperation(struct TM32CTX *ctx, uint8_t *instruction, uint16_t formatbits, uint32_t slotnumber) {
     uint8_t operation[8], ophexstring[30], opcodebits2524str[30], opsize = 0, opcodebits2524 = 0x00;
-    uint16_t currentformatfield = formatbits;
-    uint16_t opinsoffset = 0, opextoffset = 0;
+    const struct FORMATDESC *fd = GETFORMATDESC(formatbits);
+    uint8_t opinsoffset = 0, opextoffset = 0;
     uint32_t *temp32ptr;
     uint64_t *temp64ptr, opint64;
-    extern FILE *debugout;
 
-    opsize = operationsize(currentformatfield, slotnumber);
-    opinsoffset = operationoffset(currentformatfield,slotnumber);
-    opextoffset = extensionoffset(currentformatfield,slotnumber);
+    opsize = fd->opsize[slotnumber];
+    opinsoffset = fd->insoffset[slotnumber];
+    opextoffset = fd->extoffset[slotnumber];
 
     memset(operation,0x00,8);       // start afresh by clearing all bits in operation
 
     switch(opsize) {                // copy the operation bytes in the array
         case  0 :   return 0;       // we gotta NOP so return straight away
-        case 40 :   operation[3]=*(2+instruction+(opextoffset/8)+1);
-        case 32 :   operation[4]=*(2+instruction+(opextoffset/8));
-        case 24 :   operation[5]=*(2+instruction+(opinsoffset/8)+2);
-                    operation[6]=*(2+instruction+(opinsoffset/8)+1);
-                    operation[7]=*(2+instruction+(opinsoffset/8));
+        case 40 :   operation[3]=*(instruction+opextoffset+1);
+        case 32 :   operation[4]=*(instruction+opextoffset);
+        case 24 :   operation[5]=*(instruction+opinsoffset+2);
+                    operation[6]=*(instruction+opinsoffset+1);
+                    operation[7]=*(instruction+opinsoffset);
                     break;
         default :   fprintf(stderr, "opsize encoding error = %d (should be 0,26,34 or 42 bits)\n", opsize + 2);
                     return -1;
     }
     
-    fprintf(debugout, "\n-----------------------\n");
-    fprintf(debugout, "Operation in slot #%d is %d bits long; 24-bits in bytes %d-%d ", 
-                slotnumber, opsize + 2, (16+opinsoffset)/8,(16+opinsoffset+16)/8);
-
-    if((opsize-24) /8 > 0)
-        fprintf(debugout, "with %d byte extension at offset %d\n", (opsize-24)/8, (16+opextoffset)/8);
-    else
-        fprintf(debugout, "\n");
-
-    switch(getrealopindex(formatbits, slotnumber)) {
-        case 0 :    opcodebits2524 = (instruction[1] >> 6) & 0x03;  // in the 1st group of operations
-                    break;
-        case 1 :    opcodebits2524 = (instruction[1] >> 4) & 0x03;  // in the 1st group of operations
-                    break;
-        case 2 :    opcodebits2524 = (instruction[1] >> 2) & 0x03;  // in the 1st group of operations
-                    break;
-        case 3 :    opcodebits2524 = (instruction[11] >> 6) & 0x03; // in the 2nd group of operations
-                    break;
-        case 4 :    opcodebits2524 = (instruction[11] >> 4) & 0x03; // in the 2nd group of operations
-                    break;
-        default:    fprintf(stderr, "Decoding error in unpackoperation()\n");
-                    return -1;
+    if(TRACING(ctx, TRACE_UNPACK)) {
+        fprintf(ctx->traceout, "\n-----------------------\n");
+        fprintf(ctx->traceout, "Operation in slot #%d is %d bits long; 24-bits in bytes %d-%d ", 
+                    slotnumber, opsize + 2, opinsoffset, opinsoffset + 2);
+
+        if((opsize-24) /8 > 0)
+            fprintf(ctx->traceout, "with %d byte extension at offset %d\n", (opsize-24)/8, opextoffset);
+        else
+            fprintf(ctx->traceout, "\n");
     }
 
-    fprintf(debugout,"\n");
-    if(getrealopindex(formatbits, slotnumber) < 3 )     // the operation is in the first group
-        fprintf(debugout, "format byte[%d]    = 0x%02x & 0xfc = 0x%02x\n", 1 , instruction[1],  instruction[1]  & 0xfc);
-    else                                                // operation must be in the second group
-        fprintf(debugout, "format byte[%d]   = 0x%02x & 0xf0 = 0x%02x\n", 11, instruction[11], instruction[11] & 0xf0);
+                                    // opcode bits [25:24] are in the format byte of the 1st or 2nd group of operations
+    opcodebits2524 = (instruction[fd->group2[slotnumber] ? 11 : 1] >> fd->fmtshift[slotnumber]) & 0x03;
 
-    opcodebits2524tostring(opcodebits2524, opcodebits2524str);
+    if(TRACING(ctx, TRACE_UNPACK)) {
+        fprintf(ctx->traceout,"\n");
+        if(!fd->group2[slotnumber])                     // the operation is in the first group
+            fprintf(ctx->traceout, "format byte[%d]    = 0x%02x & 0xfc = 0x%02x\n", 1 , instruction[1],  instruction[1]  & 0xfc);
+        else                                            // operation must be in the second group
+            fprintf(ctx->traceout, "format byte[%d]   = 0x%02x & 0xf0 = 0x%02x\n", 11, instruction[11], instruction[11] & 0xf0);
 
-//  fprintf(debugout, "opcode bits [25-24] in little endian bit order: %s\n", opcodebits2524str);
+        opcodebits2524tostring(opcodebits2524, opcodebits2524str);
 
-    sprintf(ophexstring, "%02x %02x %02x %02x %02x %02x %02x %02x", operation[0],operation[1], operation[2],operation[3],
-                                                                    operation[4], operation[5],operation[6], operation[7]);
-    fprintf(debugout, "Op[63:0]          = %s\n", ophexstring);
+//      fprintf(ctx->traceout, "opcode bits [25-24] in little endian bit order: %s\n", opcodebits2524str);
 
-//  now we need to left shift, then a logical OR with opcode bits 25 and 24 to obtain the full opcode for our slot.
+        sprintf(ophexstring, "%02x %02x %02x %02x %02x %02x %02x %02x", operation[0],operation[1], operation[2],operation[3],
+                                                                        operation[4], operation[5],operation[6], operation[7]);
+        fprintf(ctx->traceout, "Op[63:0]          = %s\n", ophexstring);
 
-    sprintf(ophexstring, "%01x %02x %02x %02x %02x %02x", operation[2],operation[3],operation[4], operation[5],
-                                                              operation[6], operation[7]);
-    fprintf(debugout, "Op[41:0]          = %s\n", ophexstring);
+//      now we need to left shift, then a logical OR with opcode bits 25 and 24 to obtain the full opcode for our slot.
+
+        sprintf(ophexstring, "%01x %02x %02x %02x %02x %02x", operation[2],operation[3],operation[4], operation[5],
+                                                                  operation[6], operation[7]);
+        fprintf(ctx->traceout, "Op[41:0]          = %s\n", ophexstring);
+    }
 
 // swap the bytes before left shifting two bits to make room for the two extra opcode bits [25-24] from the format field
 
     temp32ptr = (uint32_t *) (operation + 1);
     *temp32ptr = bswap_32(bswap_32(*temp32ptr) << 2);
 
-    sprintf(ophexstring, "%01x %02x %02x %02x %02x %02x", 
-                operation[2],operation[3],operation[4], operation[5],operation[6], operation[7]);
+    if(TRACING(ctx, TRACE_UNPACK)) {
+        sprintf(ophexstring, "%01x %02x %02x %02x %02x %02x", 
+                    operation[2],operation[3],operation[4], operation[5],operation[6], operation[7]);
 
-    fprintf(debugout, "Op[41:24] << 2    = %s\n", ophexstring);
+        fprintf(ctx->traceout, "Op[41:24] << 2    = %s\n", ophexstring);
+    }
 
 // now splice opcode bits 25 and 24 into our byte array using a logical OR
 
     operation[4] |= opcodebits2524;
 
-    sprintf(ophexstring, "%01x %02x %02x %02x %02x %02x", 
-                operation[2],operation[3],operation[4], operation[5],operation[6], operation[7]);
+    if(TRACING(ctx, TRACE_UNPACK)) {
+        sprintf(ophexstring, "%01x %02x %02x %02x %02x %02x", 
+                    operation[2],operation[3],operation[4], operation[5],operation[6], operation[7]);
 
-    fprintf(debugout, "Op |= (%d<<24)     = %s\n", opcodebits2524, ophexstring);
+        fprintf(ctx->traceout, "Op |= (%d<<24)     = %s\n", opcodebits2524, ophexstring);
 
-    fprintf(debugout, "Op[41:0]          = %s\n", ophexstring);
+        fprintf(ctx->traceout, "Op[41:0]          = %s\n", ophexstring);
+    }
 
     temp64ptr = (uint64_t *) operation;
     opint64 = (uint64_t) bswap_64(*temp64ptr);
 
-    fprintf(debugout, "(uint64_t)op>>24  = %" PRIx64 "\n", (uint64_t)(bswap_64(opint64) >> 16));
+    TRACE(ctx, TRACE_UNPACK, "(uint64_t)op>>24  = %" PRIx64 "\n", (uint64_t)(bswap_64(opint64) >> 16));
 
     return opint64;
 }
 
 
+
+// unpackinstruction() unpacks all five operations of an instruction at once, into opbits[], each as
+// unpackoperation() would. Every field is extracted with shifts and masks from single byte loads at
+// the offsets in the format descriptor, so no bytes are copied around and nothing is byte swapped:
+//
+//   opint64 = op[23:0] | opcode bits [25:24] << 24 | extension << 26
+//
+// where the 24-bit part and the 8 or 16-bit extension are stored little-endian in the instruction.
+
+void unpackinstruction(const uint8_t *instruction, uint16_t formatbits, uint64_t *opbits) {
+    const struct FORMATDESC *fd = GETFORMATDESC(formatbits);
+    const uint8_t *op, *ext;
+    uint32_t i, opsize;
+
+    for(i=0;i<MAXSLOT;i++) {                                        // no branches, as the formats of successive
+        opsize = fd->opsize[i];                                     // instructions are too random to predict
+        op = instruction + fd->insoffset[i];
+        ext = instruction + fd->extoffset[i];
+        opbits[i] = ((uint64_t) (op[0] | op[1] << 8 | op[2] << 16)
+                  | (uint64_t) ((instruction[fd->group2[i] ? 11 : 1] >> (fd->fmtshift[i] & 7)) & 0x03) << 24
+                  | (uint64_t) ((ext[0] | ext[1] << 8) & ((1 << ((opsize - 24) & 31)) - 1)) << 26)
+                  & -(uint64_t) (opsize != 0);                      // a NOP is all zeros
+    }
+}
+
+// checkunpack() compares unpackinstruction() against unpackoperation(), slot by slot, for every
+// format field over random instruction bytes. returns the count of operations that differ
+
+uint32_t checkunpack(void) {
+    struct TM32CTX ctx;
+    uint8_t instruction[MAXTM32INSLEN / 8 + OBJPADDING];
+    uint64_t opbits[MAXSLOT];
+    uint32_t formatbits, i, n, errors = 0;
+
+    memset(&ctx, 0, sizeof(ctx));                                   // no tracing
+    srand(0x3260);
+    for(formatbits=0;formatbits<FORMATDESCCOUNT;formatbits++)
+        for(n=0;n<64;n++) {
+            for(i=0;i<sizeof(instruction);i++)
+                instruction[i] = (uint8_t) (rand() >> 4);
+            unpackinstruction(instruction, formatbits, opbits);
+            for(i=0;i<MAXSLOT;i++)
+                if(opbits[i] != unpackoperation(&ctx, instruction, formatbits, i)) {
+                    if(errors++ < 8)
+                        fprintf(stdout, "unpack mismatch: format 0x%03x slot %d: 0x%011" PRIx64 " != 0x%011" PRIx64 "\n",
+                                formatbits, i, opbits[i], unpackoperation(&ctx, instruction, formatbits, i));
+                }
+        }
+    return errors;
+}